@@ -1,61 +1,104 @@
- #include "buffer.h"
+#include "buffer.h"
 
-Buffer::Buffer(int initBuffSize) : buffer_(initBuffSize), readPos_(0), writePos_(0) {}
+// 块在第一次写的时候才从池子里取
+Buffer::Buffer() : head_(nullptr), tail_(nullptr), readable_(0) {}
 
-// 可以读的数据的大小 W指针-R指针，中间的数据就是可以读的大小
-size_t Buffer::ReadableBytes() const {  
-    return writePos_ - readPos_;
+Buffer::~Buffer() {
+    while(head_) { PopChunk_(); }
 }
 
-// buffer_中目前可以写的数据大小，缓冲区的总大小-写位置
+// 可以读的数据的大小，所有块的W指针-R指针之和
+size_t Buffer::ReadableBytes() const {
+    return readable_;
+}
+
+// 最后一块目前可以写的数据大小，块的容量-写位置
 size_t Buffer::WritableBytes() const {
-    return buffer_.size() - writePos_;
+    return tail_ ? tail_->cap - tail_->write : 0;
 }
 
-// 前面可以利用的空间，当前读取到哪个位置，就是前面可以用的空间大小，因为已经读到了，就不需要前面的空间了
+// 第一块前面已经读过的空间
 size_t Buffer::PrependableBytes() const {
-    return readPos_;
+    return head_ ? head_->read : 0;
+}
+
+size_t Buffer::ContiguousBytes() const {
+    return head_ ? head_->write - head_->read : 0;
+}
+
+size_t Buffer::Capacity() const {
+    size_t cap = 0;
+    for(BufferChunk* c = head_; c; c = c->next) {
+        cap += BufferChunk::HEADER_SIZE + c->cap;
+    }
+    return cap;
 }
 
 const char* Buffer::Peek() const {
-    return BeginPtr_() + readPos_;
+    return head_ ? head_->Data() + head_->read : "";
 }
 
 void Buffer::Retrieve(size_t len) {
     assert(len <= ReadableBytes());
-    readPos_ += len;
+    readable_ -= len;
+    while(len > 0) {
+        size_t n = head_->write - head_->read;
+        if(len < n) {
+            head_->read += len;
+            break;
+        }
+        len -= n;
+        head_->read = head_->write;
+        if(head_ == tail_) { break; }
+        PopChunk_();    // 读完的块还回去，最后一块留着继续写
+    }
+    if(readable_ == 0) {
+        Reset_();   // 读空了就从头开始写，同一块可以反复使用
+    }
 }
 
 //buff.RetrieveUntil(lineEnd + 2);
 void Buffer::RetrieveUntil(const char* end) {
-    assert(Peek() <= end );
+    assert(Peek() <= end && end <= Peek() + ContiguousBytes());
     Retrieve(end - Peek());
 }
 
-//初始化缓冲区：清零，读写位置复位
+//清空缓冲区：只留一块，读写位置复位，不清零内存
 void Buffer::RetrieveAll() {
-    bzero(&buffer_[0], buffer_.size()); //内存归0
-    readPos_ = 0;
-    writePos_ = 0;
+    readable_ = 0;
+    Reset_();
+}
+
+void Buffer::Shrink() {
+    if(readable_ == 0) {
+        while(head_) { PopChunk_(); }
+    }
 }
 
 std::string Buffer::RetrieveAllToStr() {
-    std::string str(Peek(), ReadableBytes());
+    std::string str;
+    str.reserve(readable_);
+    for(BufferChunk* c = head_; c; c = c->next) {
+        str.append(c->Data() + c->read, c->write - c->read);
+    }
     RetrieveAll();
     return str;
 }
 
 const char* Buffer::BeginWriteConst() const {
-    return BeginPtr_() + writePos_;
+    return tail_ ? tail_->Data() + tail_->write : nullptr;
 }
 
 char* Buffer::BeginWrite() {
-    return BeginPtr_() + writePos_;
+    return tail_ ? tail_->Data() + tail_->write : nullptr;
 }
 
 void Buffer::HasWritten(size_t len) {
-    writePos_ += len;
-} 
+    assert(len <= WritableBytes());
+    if(len == 0) { return; }
+    tail_->write += len;
+    readable_ += len;
+}
 
 void Buffer::Append(const std::string& str) {
     Append(str.data(), str.length());
@@ -66,45 +109,85 @@ void Buffer::Append(const void* data, size_t len) {
     Append(static_cast<const char*>(data), len);
 }
 
-/*  Append(buff, len - writable);   buff临时数组，len-writable是临时数组中的数据个数
- 将临时数组里的数据追加到buffer_中，其中如果不够需要进行memmove或者扩容后memmove
- */
+// 写满一块就接一块，不搬动已有的数据
 void Buffer::Append(const char* str, size_t len) {
     assert(str);
-    EnsureWriteable(len);
-    std::copy(str, str + len, BeginWrite());
-    HasWritten(len);
+    while(len > 0) {
+        if(WritableBytes() == 0) {
+            LinkChunk_(ChunkPool::DATA_SIZE);
+        }
+        size_t n = std::min(len, WritableBytes());
+        memcpy(BeginWrite(), str, n);
+        HasWritten(n);
+        str += n;
+        len -= n;
+    }
 }
 
 void Buffer::Append(const Buffer& buff) {
-    Append(buff.Peek(), buff.ReadableBytes());
+    for(const BufferChunk* c = buff.head_; c; c = c->next) {
+        Append(c->Data() + c->read, c->write - c->read);
+    }
 }
 
 void Buffer::EnsureWriteable(size_t len) {
-    //如果buffer_可写的字节数 小于 多出来的这个len，就扩容
+    //最后一块放不下就接一块新的
     if(WritableBytes() < len) {
-        MakeSpace_(len);
+        LinkChunk_(len);
     }
     assert(WritableBytes() >= len);
 }
 
-//具体执行 将http请求数据从cfd中读到自己vector中 的操作，返回读到的字节数
+const char* Buffer::MakeContiguous() {
+    if(head_ == tail_) { return Peek(); }
+    if(ContiguousBytes() == readable_) {
+        /* 数据都在第一块，后面是空块 */
+        BufferChunk* c = head_->next;
+        while(c) {
+            BufferChunk* next = c->next;
+            ChunkPool::Instance()->Release(c);
+            c = next;
+        }
+        head_->next = nullptr;
+        tail_ = head_;
+        return Peek();
+    }
+    BufferChunk* chunk = ChunkPool::Instance()->Acquire(std::max(readable_, ChunkPool::DATA_SIZE));
+    size_t readable = readable_;
+    for(BufferChunk* c = head_; c; c = c->next) {
+        memcpy(chunk->Data() + chunk->write, c->Data() + c->read, c->write - c->read);
+        chunk->write += c->write - c->read;
+    }
+    while(head_) { PopChunk_(); }
+    head_ = tail_ = chunk;
+    readable_ = readable;
+    return Peek();
+}
+
+int Buffer::PeekIov(struct iovec* iov, int maxCnt) const {
+    int cnt = 0;
+    for(BufferChunk* c = head_; c && cnt < maxCnt; c = c->next) {
+        if(c->write == c->read) { continue; }
+        iov[cnt].iov_base = c->Data() + c->read;
+        iov[cnt].iov_len = c->write - c->read;
+        cnt++;
+    }
+    return cnt;
+}
+
+//具体执行 将http请求数据从cfd中读到缓冲区中 的操作，返回读到的字节数
 ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
-    
-    char buff[65535];   // 临时的数组，保证能够把所有的数据都读出来
-    
-    /*创建一个IO向量数组
-     struct iovec {
-         iov_base; 指向目前buffer_的首地址
-         iov_len;  记录目前buffer_的有效长度
-     }
-     */
-    struct iovec iov[2];  //第一个向量是原vectorbuffer，第二个向量是临时数组
-    const size_t writable = WritableBytes(); //缓冲区可写数据大小
-    
-    /* 分散读， 保证数据全部读完 */
-    iov[0].iov_base = BeginPtr_() + writePos_;  //起始地址偏移写指针个量
-    iov[0].iov_len = writable;  //可写数据大小就是有效长度
+
+    char buff[65535];   // 临时的数组，最后一块放不下的部分先读到这里
+
+    /* 最后一块剩得太少就先接一块新的，大部分请求直接读进块里，不用再拷贝 */
+    if(WritableBytes() < ChunkPool::DATA_SIZE / 4) {
+        LinkChunk_(ChunkPool::DATA_SIZE);
+    }
+    struct iovec iov[2];  //第一个向量是最后一块，第二个向量是临时数组
+    const size_t writable = WritableBytes();
+    iov[0].iov_base = BeginWrite();
+    iov[0].iov_len = writable;
     iov[1].iov_base = buff;
     iov[1].iov_len = sizeof(buff);
 
@@ -112,46 +195,52 @@ ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
     if(len < 0) {
         *saveErrno = errno;
     }
-    else if(static_cast<size_t>(len) <= writable) {  //如果读到的字节数<=目前vector可写容量
-        writePos_ += len;  //那就说明不用扩容，写指针移动len即可
+    else if(static_cast<size_t>(len) <= writable) {
+        HasWritten(len);
     }
-    else {       //如果读到的字节数len > 目前vector可写容量了，就说明临时数组里也存了一些
-        writePos_ = buffer_.size();   //1.首先写指针移动到末尾
-        Append(buff, len - writable); //2.其次将临时数组中的数据接到后面
+    else {       //临时数组里也存了一些，接到后面的新块里
+        HasWritten(writable);
+        Append(buff, len - writable);
     }
     return len;
 }
 
 ssize_t Buffer::WriteFd(int fd, int* saveErrno) {
-    size_t readSize = ReadableBytes();
-    ssize_t len = write(fd, Peek(), readSize);
+    struct iovec iov[16];
+    int cnt = PeekIov(iov, 16);
+    ssize_t len = writev(fd, iov, cnt);
     if(len < 0) {
         *saveErrno = errno;
         return len;
-    } 
-    readPos_ += len;
+    }
+    Retrieve(len);
     return len;
 }
 
-char* Buffer::BeginPtr_() {
-    return &*buffer_.begin();
+void Buffer::LinkChunk_(size_t minCap) {
+    if(tail_ && tail_->read == tail_->write && tail_->cap >= minCap) {
+        /* 最后一块没有未读的数据，直接复位重用 */
+        tail_->read = tail_->write = 0;
+        return;
+    }
+    BufferChunk* chunk = ChunkPool::Instance()->Acquire(minCap);
+    if(tail_) { tail_->next = chunk; }
+    else { head_ = chunk; }
+    tail_ = chunk;
 }
 
-const char* Buffer::BeginPtr_() const {
-    return &*buffer_.begin();
+void Buffer::Reset_() {
+    assert(readable_ == 0);
+    while(head_ != tail_) { PopChunk_(); }
+    if(head_ && head_->cap > ChunkPool::DATA_SIZE) {
+        PopChunk_();    // 大块不留
+    }
+    if(head_) { head_->read = head_->write = 0; }
 }
 
-void Buffer::MakeSpace_(size_t len) {
-    //如果目前可读+前面已读<len，说明vector不够用，需扩容 
-    if(WritableBytes() + PrependableBytes() < len) {
-        buffer_.resize(writePos_ + len + 1);
-    }
-    //如果够用，就移动 
-    else {
-        size_t readable = ReadableBytes();  //就是W指针-R指针，就是目前buffer_里有的数据长度
-        std::copy(BeginPtr_() + readPos_, BeginPtr_() + writePos_, BeginPtr_());
-        readPos_ = 0;
-        writePos_ = readPos_ + readable;
-        assert(readable == ReadableBytes());
-    }
-}
\ No newline at end of file
+void Buffer::PopChunk_() {
+    BufferChunk* chunk = head_;
+    head_ = chunk->next;
+    if(!head_) { tail_ = nullptr; }
+    ChunkPool::Instance()->Release(chunk);
+}
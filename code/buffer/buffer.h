@@ -4,20 +4,29 @@
 #include <iostream>
 #include <unistd.h>  // write
 #include <sys/uio.h> //readv
-#include <vector> //readv
-#include <atomic>
+#include <string>
 #include <assert.h>
+#include "chunkpool.h"
+
+// 缓冲区：由ChunkPool里的固定大小内存块串成的链表，只在一个线程里使用，读写位置都是普通整数
+// 写满一块就接一块新的，已有数据不搬动；读完的块还回池子。清空只复位读写位置，不清零内存，
+// 为大数据临时接上的大块在读空后还回去，不会一直占着
 class Buffer {
 public:
-    Buffer(int initBuffSize = 1024);
-    ~Buffer() = default;
+    Buffer();
+    ~Buffer();
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
 
-    size_t WritableBytes() const;       
-    size_t ReadableBytes() const ;
+    size_t WritableBytes() const;       // 最后一块连续可写的字节数
+    size_t ReadableBytes() const ;      // 所有块加起来可读的字节数
     size_t PrependableBytes() const;
+    size_t ContiguousBytes() const;     // 从Peek()开始连续可读的字节数
+    size_t Capacity() const;            // 占用的内存(所有块，含块头)
 
     const char* Peek() const;
-    void EnsureWriteable(size_t len);
+    void EnsureWriteable(size_t len);   // 保证BeginWrite()开始有len个连续可写的字节
     void HasWritten(size_t len);
 
     void Retrieve(size_t len);
@@ -26,6 +35,9 @@ public:
     void RetrieveAll();  //检索所有
     std::string RetrieveAllToStr();
 
+    // 没有未读数据时把所有块还给池子，下次写的时候再取
+    void Shrink();
+
     const char* BeginWriteConst() const;
     char* BeginWrite();
 
@@ -34,17 +46,23 @@ public:
     void Append(const void* data, size_t len);
     void Append(const Buffer& buff);
 
-    ssize_t ReadFd(int fd, int* Errno); 
+    // 把所有可读数据搬到同一块里(只有跨块时才拷贝)，返回Peek()
+    const char* MakeContiguous();
+
+    // 按块填充iovec，返回用了几个，用于writev
+    int PeekIov(struct iovec* iov, int maxCnt) const;
+
+    ssize_t ReadFd(int fd, int* Errno);
     ssize_t WriteFd(int fd, int* Errno);
 
 private:
-    char* BeginPtr_();              // 获取内存起始位置
-    const char* BeginPtr_() const;  // 获取内存起始位置
-    void MakeSpace_(size_t len);    // 创建空间
+    void LinkChunk_(size_t minCap);    // 在链表尾部接一块至少minCap字节的新块
+    void PopChunk_();                  // 把第一块还给池子
+    void Reset_();                     // 读空以后只留一块普通大小的块
 
-    std::vector<char> buffer_;  // 具体装数据的vector
-    std::atomic<std::size_t> readPos_;  // 读的位置
-    std::atomic<std::size_t> writePos_; // 写的位置
+    BufferChunk* head_;     // 第一块，从这里读
+    BufferChunk* tail_;     // 最后一块，往这里写
+    size_t readable_;       // 所有块的可读字节数
 };
 
 #endif //BUFFER_H
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include "chunkpool.h"
+
+ChunkPool::ChunkPool(): freeHead_(0), slabCount_(0), usedBytes_(0) {
+    for(auto& slab: slabs_) { slab.store(nullptr, std::memory_order_relaxed); }
+}
+
+ChunkPool* ChunkPool::Instance() {
+    static ChunkPool pool;
+    return &pool;
+}
+
+BufferChunk* ChunkPool::ChunkAt_(uint32_t index) const {
+    char* slab = slabs_[index / SLAB_CHUNKS].load(std::memory_order_acquire);
+    return reinterpret_cast<BufferChunk*>(slab + (index % SLAB_CHUNKS) * CHUNK_SIZE);
+}
+
+BufferChunk* ChunkPool::Acquire(size_t minCap) {
+    BufferChunk* chunk = nullptr;
+    if(minCap > DATA_SIZE) {
+        /* 大块单独分配 */
+        size_t size = (BufferChunk::HEADER_SIZE + minCap + 63) / 64 * 64;
+        void* mem = aligned_alloc(64, size);
+        if(!mem) { throw std::bad_alloc(); }
+        chunk = new (mem) BufferChunk;
+        chunk->index = BufferChunk::NO_INDEX;
+        chunk->cap = size - BufferChunk::HEADER_SIZE;
+    } else {
+        /* 从空闲链表头取一块 */
+        uint64_t head = freeHead_.load(std::memory_order_acquire);
+        while(true) {
+            uint32_t top = static_cast<uint32_t>(head);
+            if(top == 0) {
+                Grow_();
+                head = freeHead_.load(std::memory_order_acquire);
+                continue;
+            }
+            chunk = ChunkAt_(top - 1);
+            uint32_t next = chunk->nextFree.load(std::memory_order_relaxed);
+            uint64_t newHead = (((head >> 32) + 1) << 32) | next;
+            if(freeHead_.compare_exchange_weak(head, newHead, std::memory_order_acq_rel)) { break; }
+        }
+        chunk->cap = DATA_SIZE;
+    }
+    chunk->next = nullptr;
+    chunk->read = chunk->write = 0;
+    usedBytes_.fetch_add(BufferChunk::HEADER_SIZE + chunk->cap, std::memory_order_relaxed);
+    return chunk;
+}
+
+void ChunkPool::Release(BufferChunk* chunk) {
+    assert(chunk);
+    usedBytes_.fetch_sub(BufferChunk::HEADER_SIZE + chunk->cap, std::memory_order_relaxed);
+    if(chunk->index == BufferChunk::NO_INDEX) {
+        chunk->~BufferChunk();
+        free(chunk);
+        return;
+    }
+    Push_(chunk);
+}
+
+void ChunkPool::Push_(BufferChunk* chunk) {
+    uint64_t head = freeHead_.load(std::memory_order_relaxed);
+    uint64_t newHead;
+    do {
+        chunk->nextFree.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        newHead = (((head >> 32) + 1) << 32) | (chunk->index + 1);
+    } while(!freeHead_.compare_exchange_weak(head, newHead, std::memory_order_release,
+                                             std::memory_order_relaxed));
+}
+
+// 空闲链表空了，再向系统申请一批
+void ChunkPool::Grow_() {
+    std::lock_guard<std::mutex> locker(growMtx_);
+    if(static_cast<uint32_t>(freeHead_.load(std::memory_order_acquire)) != 0) {
+        return; // 别的线程刚申请过
+    }
+    uint32_t slabIdx = slabCount_.load(std::memory_order_relaxed);
+    assert(slabIdx < MAX_SLABS);
+    char* slab = static_cast<char*>(aligned_alloc(64, SLAB_CHUNKS * CHUNK_SIZE));
+    if(!slab) { throw std::bad_alloc(); }
+    slabs_[slabIdx].store(slab, std::memory_order_release);
+    slabCount_.store(slabIdx + 1, std::memory_order_relaxed);
+    for(uint32_t i = 0; i < SLAB_CHUNKS; i++) {
+        BufferChunk* chunk = new (slab + i * CHUNK_SIZE) BufferChunk;
+        chunk->index = slabIdx * SLAB_CHUNKS + i;
+        Push_(chunk);
+    }
+}
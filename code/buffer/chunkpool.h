@@ -0,0 +1,62 @@
+#ifndef CHUNK_POOL_H
+#define CHUNK_POOL_H
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>  // aligned_alloc
+#include <assert.h>
+
+// Buffer的内存块：块头 + 数据区，数据区紧跟在块头后面
+struct BufferChunk {
+    static const size_t HEADER_SIZE = 64;       // 块头占一个缓存行
+    static const uint32_t NO_INDEX = UINT32_MAX;
+
+    BufferChunk* next;  // Buffer里的下一块
+    size_t cap;         // 数据区容量
+    size_t read;        // 读位置
+    size_t write;       // 写位置
+    uint32_t index;     // 在池里的编号，单独分配的大块为NO_INDEX
+    std::atomic<uint32_t> nextFree; // 空闲链表里的下一块(编号+1，0表示没有)
+
+    char* Data() { return reinterpret_cast<char*>(this) + HEADER_SIZE; }
+    const char* Data() const { return reinterpret_cast<const char*>(this) + HEADER_SIZE; }
+};
+
+// 全局的内存块池，块的大小固定(CHUNK_SIZE)，所有Buffer共用
+// 空闲块串成无锁链表，表头带版本号防止ABA；块按SLAB_CHUNKS个一批向系统申请，不还给系统。
+// 超过一块数据区的请求(Acquire(minCap))单独分配，释放时直接还给系统
+class ChunkPool {
+public:
+    static const size_t CHUNK_SIZE = 4096;  // 每块总大小(含块头)
+    static const size_t DATA_SIZE = CHUNK_SIZE - BufferChunk::HEADER_SIZE;
+
+    static ChunkPool* Instance();
+
+    BufferChunk* Acquire(size_t minCap = DATA_SIZE);
+
+    void Release(BufferChunk* chunk);
+
+    // 已经借出去的块的总字节数(含块头)
+    size_t UsedBytes() const { return usedBytes_.load(std::memory_order_relaxed); }
+
+private:
+    ChunkPool();
+    ~ChunkPool() = default;
+
+    BufferChunk* ChunkAt_(uint32_t index) const;
+    void Push_(BufferChunk* chunk);
+    void Grow_();
+
+    static const uint32_t SLAB_CHUNKS = 256;    // 一批的块数(1MB)
+    static const uint32_t MAX_SLABS = 16384;    // 最多16GB
+
+    std::atomic<uint64_t> freeHead_;    // 高32位版本号，低32位 编号+1
+    std::atomic<char*> slabs_[MAX_SLABS];
+    std::atomic<uint32_t> slabCount_;
+    std::mutex growMtx_;                // 只在申请新的一批时使用
+    std::atomic<size_t> usedBytes_;
+};
+
+#endif //CHUNK_POOL_H
@@ -0,0 +1,113 @@
+#include "bytescanner.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BYTE_SCANNER_X86
+#endif
+
+namespace {
+
+inline bool IsBreak(unsigned char ch) {
+    return (ch < 0x20 && ch != '\t') || ch == 0x7F;
+}
+
+/* 普通实现，也用来处理SIMD实现剩下的不足一组的尾巴 */
+const char* FindLineBreakScalar(const char* begin, const char* end) {
+    for(; begin < end; begin++) {
+        if(IsBreak(static_cast<unsigned char>(*begin))) { return begin; }
+    }
+    return end;
+}
+
+const char* FindAnyScalar(const char* begin, const char* end, const char* set, int setLen) {
+    for(; begin < end; begin++) {
+        if(memchr(set, *begin, setLen)) { return begin; }
+    }
+    return end;
+}
+
+#ifdef BYTE_SCANNER_X86
+/* SSE4.2：pcmpestri一条指令比较16个字节 */
+__attribute__((target("sse4.2")))
+const char* FindLineBreakSse42(const char* begin, const char* end) {
+    // 按范围匹配：0x00-0x08, 0x0A-0x1F, 0x7F
+    const __m128i ranges = _mm_setr_epi8(0x00, 0x08, 0x0A, 0x1F, 0x7F, 0x7F, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for(; end - begin >= 16; begin += 16) {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        int idx = _mm_cmpestri(ranges, 6, data, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if(idx < 16) { return begin + idx; }
+    }
+    return FindLineBreakScalar(begin, end);
+}
+
+__attribute__((target("sse4.2")))
+const char* FindAnySse42(const char* begin, const char* end, const char* set, int setLen) {
+    char buf[16] = { 0 };
+    memcpy(buf, set, setLen);
+    const __m128i needles = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+    for(; end - begin >= 16; begin += 16) {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        int idx = _mm_cmpestri(needles, setLen, data, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if(idx < 16) { return begin + idx; }
+    }
+    return FindAnyScalar(begin, end, set, setLen);
+}
+
+/* AVX2：一次32个字节，比较结果压成位掩码 */
+__attribute__((target("avx2")))
+const char* FindLineBreakAvx2(const char* begin, const char* end) {
+    const __m256i ctlMax = _mm256_set1_epi8(0x1F);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7F);
+    for(; end - begin >= 32; begin += 32) {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(data, ctlMax), data);    // <= 0x1F
+        ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(data, tab), ctl);
+        ctl = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(data, del));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(ctl));
+        if(mask) { return begin + __builtin_ctz(mask); }
+    }
+    return FindLineBreakScalar(begin, end);
+}
+
+__attribute__((target("avx2")))
+const char* FindAnyAvx2(const char* begin, const char* end, const char* set, int setLen) {
+    __m256i needles[16];
+    for(int i = 0; i < setLen; i++) { needles[i] = _mm256_set1_epi8(set[i]); }
+    for(; end - begin >= 32; begin += 32) {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        __m256i hit = _mm256_cmpeq_epi8(data, needles[0]);
+        for(int i = 1; i < setLen; i++) {
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(data, needles[i]));
+        }
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hit));
+        if(mask) { return begin + __builtin_ctz(mask); }
+    }
+    return FindAnyScalar(begin, end, set, setLen);
+}
+#endif
+
+}
+
+// name为nullptr时选CPU支持的最快实现；指定的实现CPU不支持返回nullptr
+const ByteScanner::Impl* ByteScanner::Resolve_(const char* name) {
+    static const Impl scalar = { "scalar", FindLineBreakScalar, FindAnyScalar };
+#ifdef BYTE_SCANNER_X86
+    static const Impl sse42 = { "sse4.2", FindLineBreakSse42, FindAnySse42 };
+    static const Impl avx2 = { "avx2", FindLineBreakAvx2, FindAnyAvx2 };
+    __builtin_cpu_init();   // 静态初始化时也会调用，要先初始化
+    if(__builtin_cpu_supports("avx2") && (!name || strcmp(name, avx2.name) == 0)) { return &avx2; }
+    if(__builtin_cpu_supports("sse4.2") && (!name || strcmp(name, sse42.name) == 0)) { return &sse42; }
+#endif
+    if(!name || strcmp(name, scalar.name) == 0) { return &scalar; }
+    return nullptr;
+}
+
+const ByteScanner::Impl* ByteScanner::impl_ = ByteScanner::Resolve_(nullptr);
+
+bool ByteScanner::Select(const char* name) {
+    const Impl* impl = Resolve_(name);
+    if(impl) { impl_ = impl; }
+    return impl != nullptr;
+}
@@ -0,0 +1,35 @@
+#ifndef BYTE_SCANNER_H
+#define BYTE_SCANNER_H
+
+#include <stddef.h>
+
+// 请求解析用的字节扫描，一次看16/32个字节
+// 启动时按CPU选择AVX2 / SSE4.2 / 普通实现，用target属性单独编译，不需要改编译选项
+class ByteScanner {
+public:
+    // [begin, end)里第一个\r、\n或不合法的控制字符(\t以外的0x00-0x1F和0x7F)，没有返回end
+    static const char* FindLineBreak(const char* begin, const char* end) {
+        return impl_->findLineBreak(begin, end);
+    }
+
+    // 第一个属于set(setLen个字符，最多16个)的字节，没有返回end
+    static const char* FindAny(const char* begin, const char* end, const char* set, int setLen) {
+        return impl_->findAny(begin, end, set, setLen);
+    }
+
+    static const char* Name() { return impl_->name; }
+
+    // 指定实现("avx2"/"sse4.2"/"scalar")，CPU不支持返回false，测试用
+    static bool Select(const char* name);
+
+private:
+    struct Impl {
+        const char* name;
+        const char* (*findLineBreak)(const char* begin, const char* end);
+        const char* (*findAny)(const char* begin, const char* end, const char* set, int setLen);
+    };
+    static const Impl* Resolve_(const char* name);
+    static const Impl* impl_;
+};
+
+#endif //BYTE_SCANNER_H
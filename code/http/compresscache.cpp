@@ -0,0 +1,176 @@
+#include "compresscache.h"
+#include "httpresponse.h"   // IsCompressible
+#include <zlib.h>
+
+CompressCache::CompressCache(): bytes_(0), closed_(false), gen_(0), level_(0), minSize_(1024), budget_(16 << 20),
+    inlineMax_(64 << 10), hits_(0), misses_(0) {}
+
+CompressCache::~CompressCache() {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        closed_ = true;
+    }
+    cond_.notify_one();
+    if(thread_.joinable()) { thread_.join(); }
+}
+
+CompressCache* CompressCache::Instance() {
+    static CompressCache cache;
+    return &cache;
+}
+
+// 文件换了版本mtime就变了，旧版本的结果不会再被命中，慢慢被淘汰
+std::string CompressCache::Key_(const FileEntry& file, int encoding) {
+    return file.path + '\0' + std::to_string(file.st.st_mtim.tv_sec) + '.'
+        + std::to_string(file.st.st_mtim.tv_nsec) + '\0' + FileEntry::ENCODING_NAME[encoding];
+}
+
+FilePtr CompressCache::Compress_(const FileEntry& file, int level) const {
+    z_stream z = {};
+    // windowBits加16输出gzip格式
+    if(deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) { return nullptr; }
+    std::shared_ptr<FileEntry> entry = std::make_shared<FileEntry>();
+    char in[65536], out[65536];
+    size_t done = 0;
+    int ret = Z_OK;
+    while(ret != Z_STREAM_END) {
+        if(z.avail_in == 0 && done < file.size) {
+            size_t n = std::min(sizeof(in), file.size - done);
+            if(file.map) {
+                z.next_in = (Bytef*)file.map + done;
+            } else {
+                ssize_t len = pread(file.fd, in, n, done);   // sendfile模式下没有映射
+                if(len <= 0) { break; }
+                n = len;
+                z.next_in = (Bytef*)in;
+            }
+            z.avail_in = n;
+            done += n;
+        }
+        z.next_out = (Bytef*)out;
+        z.avail_out = sizeof(out);
+        ret = deflate(&z, done == file.size ? Z_FINISH : Z_NO_FLUSH);
+        if(ret == Z_STREAM_ERROR) { break; }
+        entry->memory.append(out, sizeof(out) - z.avail_out);
+    }
+    deflateEnd(&z);
+    if(ret != Z_STREAM_END) { return nullptr; }
+    if(entry->memory.size() >= file.size) { return NoGain_(file); }
+
+    entry->path = file.path;
+    entry->st = file.st;
+    entry->map = &entry->memory[0];
+    entry->size = entry->cost = entry->memory.size();
+    entry->mime = file.mime;
+    entry->encoding = FileEntry::GZIP;
+    entry->etag = file.etag.substr(0, file.etag.size() - 1) + "+gzip\"";  // 和预压缩的.gz内容不同，ETag也不同
+    entry->lastModified = file.lastModified;
+    entry->MakeHeads(true);
+    return entry;
+}
+
+// 只用来占住键的空条目，淘汰和Invalidate靠path、st、encoding
+FilePtr CompressCache::NoGain_(const FileEntry& file) {
+    std::shared_ptr<FileEntry> entry = std::make_shared<FileEntry>();
+    entry->path = file.path;
+    entry->st = file.st;
+    entry->encoding = FileEntry::GZIP;
+    entry->cost = sizeof(FileEntry) + file.path.size();
+    return entry;
+}
+
+FilePtr CompressCache::Get(const FilePtr& file, bool mayBlock) {
+    int level = level_.load(std::memory_order_relaxed);
+    if(level <= 0 || !file || file->encoding != FileEntry::IDENTITY
+        || file->size < minSize_.load(std::memory_order_relaxed) || file->size > budget_.load(std::memory_order_relaxed)
+        || !HttpResponse::IsCompressible(file->mime)) {
+        return nullptr;
+    }
+    std::string key = Key_(*file, FileEntry::GZIP);
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        auto it = index_.find(key);
+        if(it != index_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);  // 挪到最前面
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            const FilePtr& entry = *it->second;
+            return entry->map ? entry : nullptr;
+        }
+        // 别的线程正在压缩这个版本，这次先发原文件
+        if(compressing_.count(key)) { return nullptr; }
+        // 事件循环线程里压缩会卡住这个reactor上所有的连接，大文件在哪个线程压缩都要很久，都交给后台
+        if(!mayBlock || file->size > inlineMax_.load(std::memory_order_relaxed)) {
+            if(jobs_.size() >= MAX_JOBS || closed_) { return nullptr; }
+            compressing_.insert(key);
+            jobs_.push_back(Job{file, key, level, gen_});
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            if(!thread_.joinable()) { thread_ = std::thread(&CompressCache::Loop_, this); }
+            cond_.notify_one();
+            return nullptr;
+        }
+        compressing_.insert(key);
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    FilePtr entry = Compress_(*file, level);
+    std::lock_guard<std::mutex> locker(mtx_);
+    compressing_.erase(key);
+    return Insert_(key, entry);
+}
+
+void CompressCache::Loop_() {
+    std::unique_lock<std::mutex> locker(mtx_);
+    while(true) {
+        while(jobs_.empty() && !closed_) { cond_.wait(locker); }
+        if(closed_) { break; }
+        Job job = std::move(jobs_.front());
+        jobs_.pop_front();
+        locker.unlock();
+        FilePtr entry = Compress_(*job.file, job.level);
+        job.file.reset();
+        locker.lock();
+        compressing_.erase(job.key);
+        if(job.gen == gen_) { Insert_(job.key, entry); }
+    }
+}
+
+FilePtr CompressCache::Insert_(const std::string& key, const FilePtr& entry) {
+    if(!entry) { return nullptr; }
+    lru_.push_front(entry);
+    index_[key] = lru_.begin();
+    bytes_ += entry->cost;
+    size_t budget = budget_.load(std::memory_order_relaxed);
+    while(bytes_ > budget && lru_.size() > 1) {
+        const FilePtr& last = lru_.back();      // 淘汰最久没用的
+        bytes_ -= last->cost;
+        index_.erase(Key_(*last, last->encoding));
+        lru_.pop_back();
+    }
+    return entry->map ? entry : nullptr;
+}
+
+void CompressCache::Invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    gen_++;
+    for(auto it = lru_.begin(); it != lru_.end();) {
+        if((*it)->path == path) {
+            bytes_ -= (*it)->cost;
+            index_.erase(Key_(**it, (*it)->encoding));
+            it = lru_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void CompressCache::Clear() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    gen_++;
+    index_.clear();
+    lru_.clear();
+    bytes_ = 0;
+}
+
+size_t CompressCache::Bytes() const {
+    std::lock_guard<std::mutex> locker(mtx_);
+    return bytes_;
+}
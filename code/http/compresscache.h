@@ -0,0 +1,81 @@
+#ifndef COMPRESS_CACHE_H
+#define COMPRESS_CACHE_H
+
+#include <list>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "filecache.h"
+
+// 没有预压缩文件时现场gzip压缩，结果按(路径, mtime, 编码)放进LRU，同一个版本的文件只压缩一次
+// 压缩结果是内容在内存里的FileEntry，和预压缩版本一样带着生成好的响应头交给发送队列
+// 压缩了不变小的也记一个空条目(map为nullptr)，之后直接发原文件，不再压缩；
+// 同一个版本正在被别的线程压缩时也先发原文件，不重复压缩
+// 事件循环线程里没命中、或者文件比inlineMax_大时不现场压缩：先发原文件，交给后台线程压缩，之后的请求再用
+class CompressCache {
+public:
+    static CompressCache* Instance();
+
+    // 返回file的gzip版本；没开启、类型不能压缩、太小、比预算还大或者压缩了没变小返回nullptr
+    // mayBlock为false(事件循环线程)时没命中返回nullptr，交给后台压缩
+    FilePtr Get(const FilePtr& file, bool mayBlock = true);
+
+    // 去掉path所有版本的压缩结果
+    void Invalidate(const std::string& path);
+    void Clear();
+
+    void SetLevel(int level) { level_ = level; }        // zlib压缩级别1-9，0关闭
+    void SetMinSize(size_t bytes) { minSize_ = bytes; } // 小于这个大小的文件不压缩
+    void SetBudget(size_t bytes) { budget_ = bytes; }
+    void SetInlineMax(size_t bytes) { inlineMax_ = bytes; }  // 比这个大的文件都交给后台压缩
+
+    bool Enabled() const { return level_.load(std::memory_order_relaxed) > 0; }
+    size_t Bytes() const;
+    size_t Hits() const { return hits_.load(std::memory_order_relaxed); }
+    size_t Misses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+    CompressCache();
+    ~CompressCache();
+
+    // 从文件的映射或者fd一段一段读出来压缩，在锁外调用；出错返回nullptr，不变小返回NoGain_
+    FilePtr Compress_(const FileEntry& file, int level) const;
+    static FilePtr NoGain_(const FileEntry& file);
+    static std::string Key_(const FileEntry& file, int encoding);
+    FilePtr Insert_(const std::string& key, const FilePtr& entry);  // 需持有mtx_
+    void Loop_();   // 后台压缩线程
+
+    struct Job {
+        FilePtr file;
+        std::string key;
+        int level;
+        size_t gen;
+    };
+    static const size_t MAX_JOBS = 64;  // 后台排队的上限，满了这次不压缩，下次请求再排
+
+    mutable std::mutex mtx_;
+    std::list<FilePtr> lru_;    // 前面是最近用过的
+    std::unordered_map<std::string, std::list<FilePtr>::iterator> index_;
+    std::unordered_set<std::string> compressing_;  // 正在压缩(包括排队)的键
+    size_t bytes_;
+    std::deque<Job> jobs_;
+    std::condition_variable cond_;
+    std::thread thread_;        // 第一次有后台任务时启动
+    bool closed_;
+    size_t gen_;                // Invalidate/Clear一次加一，之前排队的压缩结果不再放进来
+
+    std::atomic<int> level_;
+    std::atomic<size_t> minSize_;
+    std::atomic<size_t> budget_;
+    std::atomic<size_t> inlineMax_;
+    std::atomic<size_t> hits_;
+    std::atomic<size_t> misses_;
+};
+
+#endif //COMPRESS_CACHE_H
@@ -0,0 +1,223 @@
+#include "filecache.h"
+#include "httpresponse.h"   // MimeType
+#include <chrono>
+#include <time.h>
+#include <stdio.h>
+
+const char* const FileEntry::ENCODING_NAME[ENCODING_COUNT] = { "identity", "gzip", "br" };
+const char* const FileEntry::ENCODING_SUFFIX[ENCODING_COUNT] = { "", ".gz", ".br" };
+
+FileEntry::~FileEntry() {
+    if(map && memory.empty()) { munmap(map, size); }
+    if(fd >= 0) { close(fd); }
+}
+
+FileCache::FileCache(): budget_(64 << 20), revalidateMs_(1000), mapFiles_(true), hits_(0), misses_(0) {}
+
+FileCache* FileCache::Instance() {
+    static FileCache cache;
+    return &cache;
+}
+
+int64_t FileCache::NowMs_() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FileCache::Shard& FileCache::ShardOf_(const std::string& path) {
+    return shards_[std::hash<std::string>()(path) % SHARD_COUNT];
+}
+
+// 打开并映射一个普通文件
+std::shared_ptr<FileEntry> FileCache::Open_(const std::string& path) const {
+    std::shared_ptr<FileEntry> entry = std::make_shared<FileEntry>();
+    int fd = open(path.data(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { return nullptr; }
+    entry->fd = fd;
+    if(fstat(fd, &entry->st) < 0 || !S_ISREG(entry->st.st_mode)) { return nullptr; }
+    entry->size = entry->cost = entry->st.st_size;
+    // 太大不会缓存的文件(视频之类)也不映射，用sendfile按位置发，只读请求的那一段
+    if(entry->size > 0 && mapFiles_.load(std::memory_order_relaxed)
+        && entry->size <= budget_.load(std::memory_order_relaxed) / SHARD_COUNT) {
+        /* 将文件映射到内存提高文件的访问速度
+            MAP_PRIVATE 建立一个写入时拷贝的私有映射*/
+        void* map = mmap(0, entry->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map == MAP_FAILED) { return nullptr; }
+        entry->map = static_cast<char*>(map);
+    } else if(entry->size > 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);    // 按顺序发，让内核预读得多一些
+    }
+    entry->path = path;
+    entry->etag = FileEntry::MakeETag(entry->st);
+    entry->lastModified = FileEntry::HttpDate(entry->st.st_mtim.tv_sec);
+    return entry;
+}
+
+namespace {
+bool OlderThan(const struct stat& a, const struct stat& b) {
+    return a.st_mtim.tv_sec != b.st_mtim.tv_sec ? a.st_mtim.tv_sec < b.st_mtim.tv_sec
+                                                : a.st_mtim.tv_nsec < b.st_mtim.tv_nsec;
+}
+}
+
+std::string FileEntry::MakeETag(const struct stat& st) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "\"%lx-%lx-%llx\"", (unsigned long)st.st_ino, (unsigned long)st.st_size,
+             (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec);
+    return buf;
+}
+
+std::string FileEntry::HttpDate(time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buf[64];
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buf;
+}
+
+void FileEntry::MakeHeads(bool vary) {
+    std::string extra = "ETag: " + etag + "\r\nLast-Modified: " + lastModified + "\r\n";
+    if(encoding != IDENTITY) {
+        extra += std::string("Content-Encoding: ") + ENCODING_NAME[encoding] + "\r\n";
+    }
+    if(vary) { extra += "Vary: Accept-Encoding\r\n"; }
+    extra += "Accept-Ranges: bytes\r\nContent-length: " + std::to_string(size) + "\r\n\r\n";
+    for(int keepAlive = 0; keepAlive < 2; keepAlive++) {
+        head[keepAlive] = HttpResponse::MakeHead(200, keepAlive, mime) + extra;
+    }
+}
+
+// 加载源文件和它的预压缩版本，在锁外调用
+FilePtr FileCache::Load_(const std::string& path) const {
+    std::shared_ptr<FileEntry> entry = Open_(path);
+    if(!entry) { return nullptr; }
+    entry->mime = HttpResponse::MimeType(path);
+    bool compressible = HttpResponse::IsCompressible(entry->mime);
+    for(int enc = FileEntry::GZIP; compressible && enc < FileEntry::ENCODING_COUNT; enc++) {
+        std::shared_ptr<FileEntry> variant = Open_(path + FileEntry::ENCODING_SUFFIX[enc]);
+        if(!variant || OlderThan(variant->st, entry->st)) { continue; }   // 比源文件旧的已经过期了
+        variant->mime = entry->mime;
+        variant->encoding = enc;
+        // 同一个版本的源文件，各个编码的ETag前面相同，条件请求只看前面的部分
+        variant->etag = entry->etag.substr(0, entry->etag.size() - 1) + "+"
+            + (FileEntry::ENCODING_SUFFIX[enc] + 1) + "\"";
+        variant->lastModified = entry->lastModified;
+        variant->MakeHeads(true);
+        entry->cost += variant->size;
+        entry->variant[enc] = variant;
+    }
+    entry->MakeHeads(compressible);
+    return entry;
+}
+
+bool FileCache::Fresh_(const FileEntry& entry, int64_t now) const {
+    int ms = revalidateMs_.load(std::memory_order_relaxed);
+    return ms < 0 || now - entry.checkedMs.load(std::memory_order_relaxed) < ms;
+}
+
+bool FileCache::Stat(const std::string& path, FilePtr& entry, struct stat& st) {
+    Shard& shard = ShardOf_(path);
+    {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        auto it = shard.index.find(path);
+        if(it != shard.index.end() && Fresh_(**it->second, NowMs_())) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            entry = *it->second;
+            st = entry->st;
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    entry.reset();
+    return stat(path.data(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+FilePtr FileCache::Get(const std::string& path) {
+    Shard& shard = ShardOf_(path);
+    int64_t now = NowMs_();
+    FilePtr stale;
+    uint64_t gen;
+    {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        gen = shard.gen;
+        auto it = shard.index.find(path);
+        if(it != shard.index.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);  // 挪到最前面
+            FilePtr entry = *it->second;
+            if(Fresh_(*entry, now)) {
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return entry;
+            }
+            stale = entry;
+        }
+    }
+    if(stale) {
+        /* 到了该确认的时候，文件没变就继续用 */
+        struct stat st;
+        if(stat(path.data(), &st) == 0 && st.st_ino == stale->st.st_ino && st.st_size == stale->st.st_size
+            && st.st_mtim.tv_sec == stale->st.st_mtim.tv_sec && st.st_mtim.tv_nsec == stale->st.st_mtim.tv_nsec) {
+            stale->checkedMs.store(now, std::memory_order_relaxed);
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return stale;
+        }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    FilePtr entry = Load_(path);
+    std::lock_guard<std::mutex> locker(shard.mtx);
+    if(shard.gen != gen) { return entry; }     // 加载期间文件变了，读到的可能是旧内容，只给这一次用
+    auto it = shard.index.find(path);
+    if(it != shard.index.end()) { Erase_(shard, it->second); }
+    if(!entry) { return nullptr; }
+    entry->checkedMs.store(now, std::memory_order_relaxed);
+    if(entry->cost <= budget_.load(std::memory_order_relaxed) / SHARD_COUNT) {
+        Insert_(shard, entry);  // 太大的文件不缓存，这次用完就释放
+    }
+    return entry;
+}
+
+void FileCache::Insert_(Shard& shard, const FilePtr& entry) {
+    shard.lru.push_front(entry);
+    shard.index[entry->path] = shard.lru.begin();
+    shard.bytes += entry->cost;
+    size_t limit = budget_.load(std::memory_order_relaxed) / SHARD_COUNT;
+    while(shard.bytes > limit && shard.lru.size() > 1) {
+        Erase_(shard, std::prev(shard.lru.end()));  // 淘汰最久没用的
+    }
+}
+
+void FileCache::Erase_(Shard& shard, std::list<FilePtr>::iterator it) {
+    shard.bytes -= (*it)->cost;
+    shard.index.erase((*it)->path);
+    shard.lru.erase(it);
+}
+
+void FileCache::Invalidate(const std::string& path) {
+    Shard& shard = ShardOf_(path);
+    std::lock_guard<std::mutex> locker(shard.mtx);
+    shard.gen++;
+    auto it = shard.index.find(path);
+    if(it != shard.index.end()) { Erase_(shard, it->second); }
+}
+
+void FileCache::SetMapFiles(bool mapFiles) {
+    if(mapFiles_.exchange(mapFiles) != mapFiles) { Clear(); }
+}
+
+void FileCache::Clear() {
+    for(auto& shard: shards_) {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        shard.gen++;
+        shard.index.clear();
+        shard.lru.clear();
+        shard.bytes = 0;
+    }
+}
+
+size_t FileCache::Bytes() const {
+    size_t bytes = 0;
+    for(auto& shard: shards_) {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        bytes += shard.bytes;
+    }
+    return bytes;
+}
@@ -0,0 +1,113 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <unordered_map>
+#include <fcntl.h>       // open
+#include <unistd.h>      // close
+#include <sys/stat.h>    // stat
+#include <sys/mman.h>    // mmap, munmap
+
+// 缓存里的一个文件：打开的fd、整个文件的映射(sendfile模式下不映射)、stat和MIME类型
+// 用shared_ptr共享，被淘汰时还在发送的响应手里的引用仍然有效，最后一个引用释放时才munmap/close
+// 能压缩的文件旁边有不比它旧的.gz/.br时，一起加载成预压缩版本，跟着源文件一起淘汰和重新加载
+struct FileEntry {
+    enum ENCODING {
+        IDENTITY,
+        GZIP,
+        BROTLI,
+        ENCODING_COUNT,
+    };
+    static const char* const ENCODING_NAME[ENCODING_COUNT];     // Content-Encoding的值
+    static const char* const ENCODING_SUFFIX[ENCODING_COUNT];   // 预压缩文件的后缀
+
+    std::string path;
+    struct stat st;
+    int fd;
+    char* map;              // 空文件、太大或者不映射时为nullptr，文件内容用fd发；内容在memory里时指向memory
+    std::string memory;     // 现压缩出来的内容(没有fd)
+    size_t size;
+    std::string mime;
+    std::string etag;       // 强ETag(带引号)，由inode、大小、修改时间生成，压缩版本后面加+编码
+    std::string lastModified;   // 源文件修改时间，HTTP日期格式
+    std::string head[2];    // 预先生成的完整200响应头，[0]Connection: close [1]keep-alive
+    int encoding;
+    std::shared_ptr<const FileEntry> variant[ENCODING_COUNT];   // 预压缩版本，没有为空
+    size_t cost;            // 连同预压缩版本一共占的字节数
+    mutable std::atomic<int64_t> checkedMs; // 上次确认文件没变的时间
+
+    FileEntry(): fd(-1), map(nullptr), size(0), encoding(IDENTITY), cost(0), checkedMs(0) {}
+    ~FileEntry();
+
+    // 按mime、encoding、size、etag生成两种Connection的完整200响应头
+    void MakeHeads(bool vary);
+
+    static std::string MakeETag(const struct stat& st);
+    static std::string HttpDate(time_t t);
+};
+
+typedef std::shared_ptr<const FileEntry> FilePtr;
+
+// 进程内共享的静态文件缓存，按路径分片，每片一把锁，按LRU淘汰，总大小不超过字节预算
+// 命中时不做任何文件系统调用；每个条目最多每revalidateMs毫秒stat一次，文件变了就重新加载
+class FileCache {
+public:
+    static FileCache* Instance();
+
+    // 返回普通文件的条目，不存在/不是普通文件/打不开返回nullptr
+    FilePtr Get(const std::string& path);
+
+    // 只要元数据不打开文件(条件请求用)：缓存里有并且不用重新确认时entry是缓存的条目，
+    // 否则stat一下填到st里、entry为空；不存在或者不是普通文件返回false
+    bool Stat(const std::string& path, FilePtr& entry, struct stat& st);
+
+    // 让path的条目失效；正在加载的旧内容也不会再放进缓存
+    void Invalidate(const std::string& path);
+    void Clear();
+
+    void SetBudget(size_t bytes) { budget_ = bytes; }
+    // 小于0不再stat确认(有FileWatcher通知变化时)
+    void SetRevalidateMs(int ms) { revalidateMs_ = ms; }
+    int RevalidateMs() const { return revalidateMs_.load(std::memory_order_relaxed); }
+    // 是否把文件映射到内存(writev发送)；不映射时响应用sendfile从fd发，切换时清空缓存
+    void SetMapFiles(bool mapFiles);
+
+    size_t Bytes() const;
+    size_t Hits() const { return hits_.load(std::memory_order_relaxed); }
+    size_t Misses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+    FileCache();
+    ~FileCache() = default;
+
+    static const int SHARD_COUNT = 16;
+
+    struct Shard {
+        mutable std::mutex mtx;
+        std::list<FilePtr> lru;     // 前面是最近用过的
+        std::unordered_map<std::string, std::list<FilePtr>::iterator> index;
+        size_t bytes = 0;
+        uint64_t gen = 0;           // 每次Invalidate加一，加载期间变了的结果不放进缓存
+    };
+
+    FilePtr Load_(const std::string& path) const;
+    std::shared_ptr<FileEntry> Open_(const std::string& path) const;
+    static int64_t NowMs_();
+    bool Fresh_(const FileEntry& entry, int64_t now) const;
+    Shard& ShardOf_(const std::string& path);
+    void Insert_(Shard& shard, const FilePtr& entry);
+    void Erase_(Shard& shard, std::list<FilePtr>::iterator it);
+
+    Shard shards_[SHARD_COUNT];
+    std::atomic<size_t> budget_;
+    std::atomic<int> revalidateMs_;
+    std::atomic<bool> mapFiles_;
+    std::atomic<size_t> hits_;
+    std::atomic<size_t> misses_;
+};
+
+#endif //FILE_CACHE_H
@@ -0,0 +1,170 @@
+#include "filewatcher.h"
+#include "filecache.h"
+#include "compresscache.h"
+#include "../log/log.h"
+#include <dirent.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+namespace {
+// 改写完(close)、移进移出、删除、改属性(权限)都要处理；IN_MODIFY先让正在写的文件失效，写完再加载
+const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE
+                          | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+bool HasSuffix(const std::string& s, const char* suffix) {
+    size_t len = strlen(suffix);
+    return s.size() >= len && s.compare(s.size() - len, len, suffix) == 0;
+}
+}
+
+FileWatcher::FileWatcher(): fd_(-1), stopFd_(-1), revalidateMs_(1000), events_(0) {}
+
+FileWatcher::~FileWatcher() {
+    Stop();
+}
+
+bool FileWatcher::Start(const std::string& dir) {
+    if(thread_.joinable()) { return true; }
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stopFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(fd_ >= 0 && stopFd_ >= 0) { AddWatch_(dir, false); }
+    if(dirs_.empty()) {
+        if(fd_ >= 0) { close(fd_); }
+        if(stopFd_ >= 0) { close(stopFd_); }
+        fd_ = stopFd_ = -1;
+        return false;
+    }
+    // 开始监视之前加载的条目可能已经过期了
+    ClearCaches_();
+    revalidateMs_ = FileCache::Instance()->RevalidateMs();
+    FileCache::Instance()->SetRevalidateMs(-1);
+    thread_ = std::thread(&FileWatcher::Loop_, this);
+    return true;
+}
+
+void FileWatcher::Stop() {
+    if(!thread_.joinable()) { return; }
+    uint64_t one = 1;
+    ssize_t ret = write(stopFd_, &one, sizeof(one));
+    (void)ret;
+    thread_.join();
+    close(fd_);
+    close(stopFd_);
+    fd_ = stopFd_ = -1;
+    dirs_.clear();
+}
+
+void FileWatcher::Loop_() {
+    alignas(struct inotify_event) char buf[65536];
+    struct pollfd fds[2] = { { fd_, POLLIN, 0 }, { stopFd_, POLLIN, 0 } };
+    while(true) {
+        if(poll(fds, 2, -1) < 0) {
+            if(errno == EINTR) { continue; }
+            LOG_ERROR("FileWatcher poll error: %d", errno);
+            break;
+        }
+        if(fds[1].revents) { break; }
+        ssize_t n = read(fd_, buf, sizeof(buf));
+        if(n < 0) {
+            if(errno == EAGAIN || errno == EINTR) { continue; }
+            LOG_ERROR("FileWatcher read error: %d", errno);
+            break;
+        }
+        for(char* p = buf; p < buf + n;) {
+            const struct inotify_event* ev = reinterpret_cast<const struct inotify_event*>(p);
+            Handle_(ev);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    // 不再有通知，缓存回到按时间stat确认
+    FileCache::Instance()->SetRevalidateMs(revalidateMs_);
+}
+
+void FileWatcher::AddWatch_(const std::string& dir, bool preload) {
+    int wd = inotify_add_watch(fd_, dir.data(), WATCH_MASK);
+    if(wd < 0) {
+        LOG_WARN("FileWatcher can't watch %s: %d", dir.data(), errno);
+        return;
+    }
+    dirs_[wd] = dir;
+    // 先加监视再扫目录，扫的时候新建的文件不会漏掉
+    DIR* d = opendir(dir.data());
+    if(!d) { return; }
+    struct dirent* ent;
+    while((ent = readdir(d)) != nullptr) {
+        if(ent->d_name[0] == '.') { continue; }     // 隐藏文件、.和..
+        std::string path = dir + "/" + ent->d_name;
+        struct stat st;
+        if(stat(path.data(), &st) < 0) { continue; }
+        if(S_ISDIR(st.st_mode)) { AddWatch_(path, preload); }
+        else if(preload && S_ISREG(st.st_mode)) { Changed_(path, true); }
+    }
+    closedir(d);
+}
+
+void FileWatcher::RemoveWatch_(const std::string& dir) {
+    for(auto it = dirs_.begin(); it != dirs_.end();) {
+        const std::string& path = it->second;
+        if(path.compare(0, dir.size(), dir) == 0 && (path.size() == dir.size() || path[dir.size()] == '/')) {
+            inotify_rm_watch(fd_, it->first);
+            it = dirs_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FileWatcher::Handle_(const struct inotify_event* ev) {
+    events_.fetch_add(1, std::memory_order_relaxed);
+    if(ev->mask & IN_Q_OVERFLOW) {
+        // 丢了事件，不知道哪些文件变了
+        LOG_WARN("FileWatcher queue overflow, caches cleared");
+        ClearCaches_();
+        return;
+    }
+    auto it = dirs_.find(ev->wd);
+    if(it == dirs_.end()) { return; }
+    if(ev->mask & IN_IGNORED) {     // 目录被删了或者监视被去掉了
+        dirs_.erase(it);
+        return;
+    }
+    if(ev->len == 0) {
+        // 目录自己被删或者被移走，子目录的事件父目录也会报，这里主要是资源根目录
+        if(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) { ClearCaches_(); }
+        return;
+    }
+    std::string path = it->second + "/" + ev->name;
+    if(ev->mask & IN_ISDIR) {
+        if(ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+            AddWatch_(path, true);
+        } else if(ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            // 不知道下面缓存了哪些文件，全部清掉
+            RemoveWatch_(path);
+            ClearCaches_();
+        }
+        return;
+    }
+    Changed_(path, ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO));
+}
+
+// 文件变了：它自己和它的源文件(是.gz/.br时)失效，写完的重新加载源文件
+void FileWatcher::Changed_(const std::string& path, bool reload) {
+    if(HasSuffix(path, ".tmp")) { return; }     // 写完会rename成正式的文件，到时候再处理
+    std::string source = path;
+    for(int enc = FileEntry::GZIP; enc < FileEntry::ENCODING_COUNT; enc++) {
+        if(HasSuffix(path, FileEntry::ENCODING_SUFFIX[enc])) {
+            source = path.substr(0, path.size() - strlen(FileEntry::ENCODING_SUFFIX[enc]));
+            FileCache::Instance()->Invalidate(path);
+            break;
+        }
+    }
+    FileCache::Instance()->Invalidate(source);
+    CompressCache::Instance()->Invalidate(source);
+    if(reload) { FileCache::Instance()->Get(source); }  // 第一个请求不用等加载
+}
+
+void FileWatcher::ClearCaches_() {
+    FileCache::Instance()->Clear();
+    CompressCache::Instance()->Clear();
+}
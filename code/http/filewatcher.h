@@ -0,0 +1,42 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <sys/inotify.h>
+
+// 用inotify在后台线程监视资源目录(包括子目录)：文件被改写、移走、删除时让文件缓存和压缩缓存里的条目失效，
+// 新写完或者移进来的文件马上加载进缓存；.gz/.br变了重新加载源文件。监视期间缓存条目不再定期stat确认
+class FileWatcher {
+public:
+    FileWatcher();
+    ~FileWatcher();
+
+    // dir和HttpResponse用的srcDir一样，缓存的键是dir + "/" + 相对路径
+    // inotify不可用时返回false，缓存照旧按时间stat确认
+    bool Start(const std::string& dir);
+    void Stop();
+
+    bool IsRunning() const { return thread_.joinable(); }
+    size_t Events() const { return events_.load(std::memory_order_relaxed); }
+
+private:
+    void Loop_();
+    // 监视dir和它下面所有的子目录，preload时把里面的文件加载进缓存
+    void AddWatch_(const std::string& dir, bool preload);
+    void RemoveWatch_(const std::string& dir);  // 目录被移走：去掉它和子目录的监视
+    void Handle_(const struct inotify_event* ev);
+    void Changed_(const std::string& path, bool reload);
+    static void ClearCaches_();
+
+    int fd_;        // inotify
+    int stopFd_;    // eventfd，Stop时唤醒后台线程
+    int revalidateMs_;  // 开始监视前缓存的确认间隔，停止时恢复
+    std::thread thread_;
+    std::unordered_map<int, std::string> dirs_;   // 监视描述符 -> 目录路径，只在Start和后台线程里访问
+    std::atomic<size_t> events_;
+};
+
+#endif //FILE_WATCHER_H
@@ -0,0 +1,62 @@
+#include "headertable.h"
+#include <ctype.h>
+
+namespace {
+// 常用请求头的名字，下标就是编号
+const std::string_view KNOWN_NAMES[HeaderTable::KNOWN_COUNT] = {
+    "Connection",
+    "Content-Length",
+    "Content-Type",
+    "Host",
+    "Accept-Encoding",
+    "If-None-Match",
+    "If-Modified-Since",
+    "Range",
+    "If-Range",
+    "Transfer-Encoding",
+};
+}
+
+bool HeaderTable::EqualsNoCase(std::string_view a, std::string_view b) {
+    if(a.size() != b.size()) { return false; }
+    for(size_t i = 0; i < a.size(); i++) {
+        if(tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 先比长度和首字母，大部分不认识的名字比一两次就排除了
+HeaderTable::HEADER_ID HeaderTable::Lookup(std::string_view name) {
+    if(name.empty()) { return OTHER; }
+    int first = tolower(static_cast<unsigned char>(name[0]));
+    for(int id = 0; id < KNOWN_COUNT; id++) {
+        const std::string_view& known = KNOWN_NAMES[id];
+        if(known.size() == name.size() && tolower(static_cast<unsigned char>(known[0])) == first
+            && EqualsNoCase(known, name)) {
+            return static_cast<HEADER_ID>(id);
+        }
+    }
+    return OTHER;
+}
+
+HeaderTable::HEADER_ID HeaderTable::Add(std::string_view name, std::string_view value) {
+    HEADER_ID id = Lookup(name);
+    Field field = { name, value, id };
+    if(size_ < INLINE_CAPACITY) { fields_[size_] = field; }
+    else { overflow_.push_back(field); }
+    size_++;
+    if(id != OTHER) { slots_[id] = static_cast<uint16_t>(size_); }
+    return id;
+}
+
+std::string_view HeaderTable::Get(std::string_view name) const {
+    HEADER_ID id = Lookup(name);
+    if(id != OTHER) { return Get(id); }
+    for(size_t i = size_; i > 0; i--) {
+        const Field& field = At_(i - 1);
+        if(EqualsNoCase(field.name, name)) { return field.value; }
+    }
+    return std::string_view();
+}
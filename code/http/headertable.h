@@ -0,0 +1,87 @@
+#ifndef HEADER_TABLE_H
+#define HEADER_TABLE_H
+
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+// 请求头表：名字和值都是指向读缓冲区的string_view，前INLINE_CAPACITY个存在对象内部，
+// 解析一般的请求不分配内存。常用的请求头解析时识别成固定编号(不区分大小写)，按编号O(1)查找
+class HeaderTable {
+public:
+    enum HEADER_ID {
+        CONNECTION,
+        CONTENT_LENGTH,
+        CONTENT_TYPE,
+        HOST,
+        ACCEPT_ENCODING,
+        IF_NONE_MATCH,
+        IF_MODIFIED_SINCE,
+        RANGE,
+        IF_RANGE,
+        TRANSFER_ENCODING,
+        KNOWN_COUNT,
+        OTHER = KNOWN_COUNT,    // 不认识的请求头
+    };
+
+    struct Field {
+        std::string_view name;
+        std::string_view value;
+        HEADER_ID id;
+    };
+
+    HeaderTable(): size_(0) { ClearSlots_(); }
+
+    // 添加一个请求头，返回识别出的编号；同名的请求头按编号查到的是最后一个
+    HEADER_ID Add(std::string_view name, std::string_view value);
+
+    std::string_view Get(HEADER_ID id) const {
+        return slots_[id] ? At_(slots_[id] - 1).value : std::string_view();
+    }
+    std::string_view Get(std::string_view name) const;
+
+    size_t Size() const { return size_; }
+    const Field& operator[](size_t i) const { return At_(i); }
+
+    void Clear() {
+        size_ = 0;
+        overflow_.clear();
+        ClearSlots_();
+    }
+
+    // 释放溢出部分占用的内存
+    void Shrink() {
+        Clear();
+        std::vector<Field>().swap(overflow_);
+    }
+
+    // 所有string_view用f重新映射(读缓冲区里的数据被挪动过)
+    template<class F>
+    void Rebase(F f) {
+        for(size_t i = 0; i < size_; i++) {
+            Field& field = At_(i);
+            field.name = f(field.name);
+            field.value = f(field.value);
+        }
+    }
+
+    static HEADER_ID Lookup(std::string_view name);
+    static bool EqualsNoCase(std::string_view a, std::string_view b);
+
+private:
+    static const size_t INLINE_CAPACITY = 16;
+
+    Field& At_(size_t i) { return i < INLINE_CAPACITY ? fields_[i] : overflow_[i - INLINE_CAPACITY]; }
+    const Field& At_(size_t i) const { return i < INLINE_CAPACITY ? fields_[i] : overflow_[i - INLINE_CAPACITY]; }
+    void ClearSlots_() {
+        for(auto& slot: slots_) { slot = 0; }
+    }
+
+    Field fields_[INLINE_CAPACITY];
+    std::vector<Field> overflow_;   // 超过INLINE_CAPACITY个的部分
+    size_t size_;
+    uint16_t slots_[KNOWN_COUNT];   // 常用请求头的位置+1，0表示没有
+};
+
+#endif //HEADER_TABLE_H
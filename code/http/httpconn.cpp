@@ -3,6 +3,8 @@ using namespace std;
 
 const char* HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount;  //原子类型的变量userCount计数
+std::atomic<size_t> HttpConn::readBudgetHits;
+std::atomic<size_t> HttpConn::writeBudgetHits;
 
 bool HttpConn::isET;
 
@@ -10,6 +12,8 @@ HttpConn::HttpConn() {
     fd_ = -1;
     addr_ = { 0 };
     isClose_ = true;
+    isKeepAlive_ = false;
+    pendingHead_ = refBytes_ = fed_ = 0;
 };
 
 HttpConn::~HttpConn() { 
@@ -25,8 +29,11 @@ void HttpConn::init(int fd, const sockaddr_in& addr) {
     // 初始化写缓冲和读缓冲
     writeBuff_.RetrieveAll(); //缓冲区也是一个类Buffer，调用Buffer类的RetrieveAll()
     readBuff_.RetrieveAll();
+    fed_ = 0;
     isClose_ = false;
-    LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+    isKeepAlive_ = true;
+    LOG_INFO("Client[%d](%s:%d) in, userCount:%d, bytes/conn:%zu",
+             fd_, GetIP(), GetPort(), (int)userCount, BytesPerConn());
 }
 
 void HttpConn::Close() {
@@ -35,7 +42,14 @@ void HttpConn::Close() {
         isClose_ = true; 
         userCount--;
         close(fd_);
-        LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+        readBuff_.RetrieveAll();
+        writeBuff_.RetrieveAll();
+        while(pendingHead_ < pending_.size()) { PopPending_(); }
+        request_.Init();
+        Shrink();
+        LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d, budget hits read/write:%zu/%zu", fd_, GetIP(), GetPort(),
+                 (int)userCount, readBudgetHits.load(std::memory_order_relaxed),
+                 writeBudgetHits.load(std::memory_order_relaxed));
     }
 }
 
@@ -55,78 +69,233 @@ int HttpConn::GetPort() const {
     return addr_.sin_port;
 }
 
+void HttpConn::Shrink() {
+    if(readBuff_.ReadableBytes() || ToWriteBytes()) { return; }
+    readBuff_.Shrink();
+    writeBuff_.Shrink();
+    request_.Shrink();
+    response_.Shrink();
+    std::vector<Pending>().swap(pending_);
+    pendingHead_ = 0;
+}
+
+// 队头的响应发完了，放掉文件的引用
+void HttpConn::PopPending_() {
+    Pending& p = pending_[pendingHead_++];
+    refBytes_ -= p.prebuiltLen + p.fileLen;
+    p.file.reset();
+    if(pendingHead_ == pending_.size()) {
+        pending_.clear();
+        pendingHead_ = 0;
+    }
+}
+
+void HttpConn::PushPending_(size_t headLen, std::string_view prebuilt, const char* data, off_t offset,
+                            size_t fileLen, FilePtr file) {
+    Pending p;
+    p.headLen = headLen;
+    p.prebuilt = prebuilt.data();
+    p.prebuiltLen = prebuilt.size();
+    p.data = data;
+    p.offset = offset;
+    p.fileLen = fileLen;
+    p.file = std::move(file);
+    refBytes_ += p.prebuiltLen + p.fileLen;
+    pending_.push_back(std::move(p));
+}
+
+size_t HttpConn::BytesPerConn() {
+    int count = userCount;
+    if(count <= 0) { return sizeof(HttpConn); }
+    return sizeof(HttpConn) + ChunkPool::Instance()->UsedBytes() / count;
+}
+
 ssize_t HttpConn::read(int* saveErrno) {
-    // 一次性读出所有数据
+    // 事件后端已经把数据收进来了，这一轮不再调read；socket里剩下的等下一次EPOLLIN
+    if(fed_) {
+        ssize_t len = static_cast<ssize_t>(fed_);
+        fed_ = 0;
+        return len;
+    }
+    // ET模式读到EAGAIN为止，但一次最多读READ_BUDGET字节、MAX_IO_TURNS次，
+    // 剩下的数据等处理完这一批请求、重新注册EPOLLIN后排到就绪队列后面再读
     ssize_t len = -1;
+    size_t got = 0;
+    int turns = 0;
     do {
         len = readBuff_.ReadFd(fd_, saveErrno);
         if (len <= 0) {
             break;
         }
+        got += len;
+        if(got >= READ_BUDGET || ++turns >= MAX_IO_TURNS) {
+            readBudgetHits.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
     } while (isET);
     return len;
 }
 
+void HttpConn::Feed(const char* data, size_t len) {
+    readBuff_.Append(data, len);
+    fed_ += len;
+}
+
+// 按顺序把各个响应的 响应头(writeBuff_的块里切出来或者预先生成的)+文件映射 拼起来，一次分散写
+// 遇到用sendfile发的文件就停在它的响应头后面，带MSG_MORE让响应头和随后的文件内容凑成整包发出
+ssize_t HttpConn::WriteIov_() {
+    struct iovec headIov[MAX_IOV];
+    struct iovec iov[MAX_IOV];
+    int headCnt = writeBuff_.PeekIov(headIov, MAX_IOV);
+    int iovCnt = 0, hi = 0;
+    size_t hoff = 0;
+    bool more = false;
+    for(size_t i = pendingHead_; i < pending_.size() && iovCnt < MAX_IOV; i++) {
+        const Pending& p = pending_[i];
+        size_t need = p.headLen;
+        while(need > 0 && hi < headCnt && iovCnt < MAX_IOV) {
+            size_t n = std::min(need, headIov[hi].iov_len - hoff);
+            iov[iovCnt].iov_base = (char*)headIov[hi].iov_base + hoff;
+            iov[iovCnt].iov_len = n;
+            iovCnt++;
+            need -= n;
+            hoff += n;
+            if(hoff == headIov[hi].iov_len) { hi++; hoff = 0; }
+        }
+        if(need > 0 || iovCnt == MAX_IOV) { break; }
+        if(p.prebuiltLen) {
+            iov[iovCnt].iov_base = const_cast<char*>(p.prebuilt);
+            iov[iovCnt].iov_len = p.prebuiltLen;
+            iovCnt++;
+            if(iovCnt == MAX_IOV) { break; }
+        }
+        if(IsSendfile_(p)) {
+            more = true;
+            break;
+        }
+        if(p.fileLen) {
+            iov[iovCnt].iov_base = const_cast<char*>(p.data) + p.offset;
+            iov[iovCnt].iov_len = p.fileLen;
+            iovCnt++;
+        }
+    }
+    struct msghdr msg = { 0 };
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovCnt;
+    return sendmsg(fd_, &msg, more ? MSG_MORE : 0);
+}
+
+// 从队头开始扣掉写出去的字节，整个发完的响应出队
+void HttpConn::Consume_(size_t len) {
+    while(pendingHead_ < pending_.size()) {
+        Pending& p = pending_[pendingHead_];
+        size_t head = std::min(len, p.headLen);
+        writeBuff_.Retrieve(head);
+        p.headLen -= head;
+        len -= head;
+        size_t prebuilt = std::min(len, p.prebuiltLen);
+        p.prebuilt += prebuilt;
+        p.prebuiltLen -= prebuilt;
+        refBytes_ -= prebuilt;
+        len -= prebuilt;
+        size_t file = std::min(len, p.fileLen);
+        p.offset += file;
+        p.fileLen -= file;
+        refBytes_ -= file;
+        len -= file;
+        if(p.headLen || p.prebuiltLen || p.fileLen) { break; }
+        PopPending_();
+    }
+}
+
 ssize_t HttpConn::write(int* saveErrno) {
     ssize_t len = -1;
-    do {
-        // 分散写数据
-        len = writev(fd_, iov_, iovCnt_);
+    size_t sent = 0;
+    int turns = 0;
+    for(;;) {
+        Pending* front = pendingHead_ < pending_.size() ? &pending_[pendingHead_] : nullptr;
+        if(front && front->headLen == 0 && front->prebuiltLen == 0 && IsSendfile_(*front)) {
+            // 响应头发完了，文件内容由内核直接从页缓存发到socket，大文件一块一块发，不占用户态内存
+            off_t offset = front->offset;
+            size_t chunk = front->fileLen < STREAM_CHUNK ? front->fileLen : STREAM_CHUNK;
+            if(chunk < front->fileLen) {
+                posix_fadvise(front->file->fd, offset + chunk, STREAM_CHUNK, POSIX_FADV_WILLNEED);
+            }
+            len = sendfile(fd_, front->file->fd, &offset, chunk);
+        } else {
+            len = WriteIov_();
+        }
         if(len <= 0) {
             *saveErrno = errno;
             break;
         }
-        // 这种情况是所有数据都传输结束了
-        if(iov_[0].iov_len + iov_[1].iov_len  == 0) { break; } /* 传输结束 */
-        // 写到了第二块内存，做相应的处理
-        else if(static_cast<size_t>(len) > iov_[0].iov_len) {
-            iov_[1].iov_base = (uint8_t*) iov_[1].iov_base + (len - iov_[0].iov_len);
-            iov_[1].iov_len -= (len - iov_[0].iov_len);
-            if(iov_[0].iov_len) {
-                writeBuff_.RetrieveAll();
-                iov_[0].iov_len = 0;
-            }
-        }
-        // 还没有写到第二块内存的数据
-        else {
-            iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len; 
-            iov_[0].iov_len -= len; 
-            writeBuff_.Retrieve(len);
+        Consume_(len);
+        sent += len;
+        if(ToWriteBytes() == 0) { break; } /* 传输结束 */
+        if(sent >= WRITE_BUDGET || ++turns >= MAX_IO_TURNS) {
+            // 一个大下载不能一直占着线程，让给别的连接：重新注册EPOLLOUT排到就绪队列后面
+            writeBudgetHits.fetch_add(1, std::memory_order_relaxed);
+            *saveErrno = EAGAIN;
+            len = -1;
+            break;
         }
-    } while(isET || ToWriteBytes() > 10240);
+    }
     return len;
 }
 
 // 业务逻辑处理
-bool HttpConn::process() {
-    // 初始化请求对象
-    request_.Init();
-    
-    if(readBuff_.ReadableBytes() <= 0) {// 没有请求数据
+// 请求的解析状态保留在request_里，数据不全时等下次读到更多数据接着解析
+bool HttpConn::process(bool mayBlock, bool onLoop) {
+    if(readBuff_.ReadableBytes() <= 0) {// 没有请求数据，连接空闲了
+        Shrink();
         return false;
     }
-    else if(request_.parse(readBuff_)) {    // 如果成功解析了请求数据
-        LOG_DEBUG("%s", request_.path().c_str());
-        // 解析完请求数据以后，初始化响应对象
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
-    } else {
-        // 解析失败
-        response_.Init(srcDir, request_.path(), false, 400);
-    }
+    int queued = 0;
+    // 要关闭的连接后面的请求不再处理
+    while(readBuff_.ReadableBytes() > 0 && isKeepAlive_ && queued < MAX_PIPELINE) {
+        if(request_.parse(readBuff_, !mayBlock)) {    // 如果成功解析了请求数据
+            if(!request_.IsFinished()) { break; }  // 请求还没收全(或者要换到线程池处理)，等下次接着解析
+            LOG_DEBUG("%s", request_.path().c_str());
+            // 解析完请求数据以后，初始化响应对象
+            response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200,
+                           request_.GetHeader(HeaderTable::ACCEPT_ENCODING));
+            if(request_.method() == "GET" || request_.method() == "HEAD") {
+                response_.SetConditions(request_.GetHeader(HeaderTable::IF_NONE_MATCH),
+                                        request_.GetHeader(HeaderTable::IF_MODIFIED_SINCE));
+                response_.SetRange(request_.GetHeader(HeaderTable::RANGE),
+                                   request_.GetHeader(HeaderTable::IF_RANGE));
+            }
+        } else {
+            // 解析失败
+            response_.Init(srcDir, request_.path(), false, 400);
+        }
+
+        // 生成响应信息（响应头接在writeBuff_后面或者用缓存里生成好的），文件的引用交给发送队列
+        size_t before = writeBuff_.ReadableBytes();
+        response_.SetOnLoop(onLoop);
+        response_.MakeResponse(writeBuff_);
+        const std::vector<HttpResponse::Segment>& segments = response_.Segments();
+        if(segments.empty()) {
+            // ReleaseFile之后就取不到文件和响应头了，先取出来
+            std::string_view prebuilt = response_.PrebuiltHead();
+            const char* data = response_.File();
+            size_t fileLen = response_.FileLen();
+            PushPending_(writeBuff_.ReadableBytes() - before, prebuilt, data, 0, fileLen, response_.ReleaseFile());
+        } else {
+            // 206：每段一个Pending，共用文件的引用
+            FilePtr file = response_.ReleaseFile();
+            for(const HttpResponse::Segment& seg: segments) {
+                PushPending_(seg.headLen, std::string_view(), file->map, seg.offset, seg.len, file);
+            }
+        }
+        isKeepAlive_ = response_.IsKeepAlive();
+        LOG_DEBUG("filesize:%zu to %zu", pending_.back().fileLen, ToWriteBytes());
 
-    // 生成响应信息（writeBuff_中保存着响应的一些信息）
-    response_.MakeResponse(writeBuff_);
-    /* 响应头 */
-    iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
-    iov_[0].iov_len = writeBuff_.ReadableBytes();
-    iovCnt_ = 1;
-
-    /* 如果请求了文件 */
-    if(response_.FileLen() > 0  && response_.File()) {
-        iov_[1].iov_base = response_.File();
-        iov_[1].iov_len = response_.FileLen();
-        iovCnt_ = 2;
+        // 请求里的string_view到这里就用完了，再取走这个请求的数据；解析失败的连接会关闭，数据不保留
+        if(request_.IsFinished()) { readBuff_.Retrieve(request_.Consumed()); }
+        else { readBuff_.RetrieveAll(); }
+        request_.Init();    // 下一个请求从头开始
+        queued++;
     }
-    LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
-    return true;
+    return queued > 0;
 }
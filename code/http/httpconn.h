@@ -3,9 +3,14 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>     // readv/writev
+#include <sys/socket.h>  // sendmsg
+#include <sys/sendfile.h> // sendfile
+#include <fcntl.h>       // posix_fadvise
 #include <arpa/inet.h>   // sockaddr_in
 #include <stdlib.h>      // atoi()
 #include <errno.h>      
+#include <limits.h>      // IOV_MAX
+#include <vector>
 
 #include "../log/log.h"
 #include "../pool/sqlconnRAII.h"
@@ -14,7 +19,8 @@
 #include "httpresponse.h"
 
 // Http连接类，其中封装了请求和响应对象
-class HttpConn {
+// 按缓存行对齐，相邻fd的连接对象不会共享缓存行
+class alignas(64) HttpConn {
 public:
     HttpConn();
 
@@ -24,8 +30,18 @@ public:
 
     ssize_t read(int* saveErrno);  //读数据
 
+    // 事件后端已经收到的数据(io_uring的recv)，放进读缓冲区，下一次read直接返回它，不再调read
+    void Feed(const char* data, size_t len);
+
+    // 发送队列里的响应，发完、socket写满(EAGAIN)或者用完这次的预算为止；
+    // 预算用完没发完也返回-1、errno为EAGAIN，由EPOLLOUT接着发
     ssize_t write(int* saveErrno);
 
+    static const size_t STREAM_CHUNK = 1 << 20; // 一次sendfile最多发的字节数，同时预读下一块
+    static const size_t WRITE_BUDGET = 4 << 20; // 一次write最多发的字节数
+    static const size_t READ_BUDGET = 256 << 10; // 一次read最多读的字节数
+    static const int MAX_IO_TURNS = 16;         // 一次read/write最多的系统调用次数
+
     void Close();
 
     int GetFd() const;
@@ -36,20 +52,43 @@ public:
     
     sockaddr_in GetAddr() const;
     
-    bool process();
+    // 把readBuff_里所有完整的请求(流水线)依次生成响应排进发送队列，没有完整的请求返回false
+    // mayBlock为false(事件循环线程)时遇到要查数据库的请求就停下，由IsBlockingRequest()告诉调用者交给线程池
+    // onLoop为true(事件循环线程，多reactor模式mayBlock也是true)时现场压缩没命中不等压缩，先发原文件
+    bool process(bool mayBlock = true, bool onLoop = false);
+
+    // 连接空闲(没有未处理的请求和未发完的响应)时把缓冲区还给池子，释放请求和响应占用的内存
+    void Shrink();
+
+    // 每个连接平均占用的字节数：连接对象本身加上借出去的缓冲区块
+    static size_t BytesPerConn();
+
+    // 还没发的字节数，包括直接引用的文件内容，大文件会超过int
+    size_t ToWriteBytes() const {
+        return writeBuff_.ReadableBytes() + refBytes_; 
+    }
 
-    int ToWriteBytes() { 
-        return iov_[0].iov_len + iov_[1].iov_len; 
+    // 发送队列里还没发完的响应数
+    size_t PendingResponses() const {
+        return pending_.size() - pendingHead_;
     }
 
+    // 最后一个排队的响应是否保持连接
     bool IsKeepAlive() const {
-        return request_.IsKeepAlive();
+        return isKeepAlive_;
+    }
+
+    // process停在了需要阻塞操作(登录注册要查数据库)的请求前面，这样的请求不在事件循环线程里处理
+    bool IsBlockingRequest() const {
+        return request_.IsBlocking();
     }
 
     //静态成员变量
     static bool isET;   //是ET判断
     static const char* srcDir;  // 资源的目录
     static std::atomic<int> userCount; // 总共连入的的客户端数量，因为是记录这个类的通用性质，因此要用静态变量
+    static std::atomic<size_t> readBudgetHits;  // 读/写用完预算让出线程的次数
+    static std::atomic<size_t> writeBudgetHits;
     
 private:
     //每个连入用户的fd和addr_，需要记录在hashmap中
@@ -57,9 +96,36 @@ private:
     struct  sockaddr_in addr_;  //连入用户的IP
 
     bool isClose_; //记录这个连接是否关闭了的选项
-    
-    int iovCnt_;    // 分散内存的数量
-    struct iovec iov_[2];   // 分散内存
+    bool isKeepAlive_;
+
+    // 发送队列里的一个响应：现生成的响应头按顺序放在writeBuff_里，缓存里预先生成的响应头和
+    // 文件内容直接引用缓存条目，文件没有映射(sendfile模式)时用sendfile从缓存的fd发
+    struct Pending {
+        size_t headLen;     // writeBuff_里还没发的响应头字节数
+        const char* prebuilt;   // 还没发的预先生成的响应头
+        size_t prebuiltLen;
+        const char* data;   // 文件的映射，nullptr表示用sendfile
+        off_t offset;       // 文件已经发到的位置
+        size_t fileLen;     // 还没发的文件字节数
+        FilePtr file;       // 持有缓存条目，发完之前映射和fd不会被释放
+    };
+
+    bool IsSendfile_(const Pending& p) const {
+        return p.fileLen && !p.data;
+    }
+    void PushPending_(size_t headLen, std::string_view prebuilt, const char* data, off_t offset,
+                      size_t fileLen, FilePtr file);
+    ssize_t WriteIov_();
+    void Consume_(size_t len);
+    void PopPending_();
+
+    static const int MAX_IOV = IOV_MAX;     // 一次writev最多的块数
+    static const int MAX_PIPELINE = 64;     // 一次最多排队的响应数，其余的发完再处理
+
+    std::vector<Pending> pending_;  // 按请求顺序排队的响应，从pendingHead_开始没发完
+    size_t pendingHead_;
+    size_t refBytes_;               // 队列里直接引用缓存条目还没发的字节数(预先生成的响应头和文件)
+    size_t fed_;                    // Feed进来还没被read取走的字节数
     
     Buffer readBuff_;   // 读(请求)缓冲区，保存请求数据的内容
     Buffer writeBuff_;  // 写(响应)缓冲区，保存响应数据的内容
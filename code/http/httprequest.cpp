@@ -8,32 +8,101 @@ const unordered_set<string> HttpRequest::DEFAULT_HTML{
 const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
             {"/register.html", 0}, {"/login.html", 1},  };
 
+namespace {
+// 字符类别表(RFC 7230)：token字符、可见字符、数字
+enum : uint8_t { TCHAR = 1, VCHAR = 2, DIGIT = 4 };
+
+struct CharTable {
+    uint8_t t[256];
+    constexpr CharTable(): t() {
+        for(int c = 0x21; c <= 0x7E; c++) { t[c] |= VCHAR; }
+        for(int c = '0'; c <= '9'; c++) { t[c] |= TCHAR | DIGIT; }
+        for(int c = 'a'; c <= 'z'; c++) { t[c] |= TCHAR; }
+        for(int c = 'A'; c <= 'Z'; c++) { t[c] |= TCHAR; }
+        for(const char* p = "!#$%&'*+-.^_`|~"; *p; p++) { t[int(*p)] |= TCHAR; }
+    }
+};
+
+constexpr CharTable CHAR_TABLE;
+
+inline bool Is(char ch, uint8_t cls) {
+    return CHAR_TABLE.t[static_cast<unsigned char>(ch)] & cls;
+}
+
+// 从begin开始连续属于cls的字符个数
+inline size_t Span(std::string_view s, size_t begin, uint8_t cls) {
+    size_t i = begin;
+    while(i < s.size() && Is(s[i], cls)) { i++; }
+    return i - begin;
+}
+
+}
+
 // 初始化请求对象信息，数据初始化为空
 void HttpRequest::Init() {
-    method_ = path_ = version_ = body_ = "";  //最开始肯定都是空字符串
+    method_ = version_ = {};
+    path_ = body_ = "";
     state_ = REQUEST_LINE;   //开始为请求首行阶段
-    header_.clear();
+    base_ = nullptr;
+    pos_ = scanned_ = 0;
+    contentLength_ = 0;
+    isKeepAlive_ = false;
+    header_.Clear();
     post_.clear();
 }
 
+void HttpRequest::Shrink() {
+    Init();
+    string().swap(path_);
+    string().swap(body_);
+    header_.Shrink();
+    unordered_map<string, string>().swap(post_);
+}
+
 bool HttpRequest::IsKeepAlive() const {
-    if(header_.count("Connection") == 1) {
-        return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
-    }
-    return false;
+    return isKeepAlive_;
+}
+
+// 解析请求数据：按行推进的状态机，每行找到\r\n后按字符类别表校验、切分
+bool HttpRequest::IsBlocking() const {
+    return state_ == BODY && method_ == "POST" && DEFAULT_HTML_TAG.count(path_)
+        && GetHeader(HeaderTable::CONTENT_TYPE) == "application/x-www-form-urlencoded";
 }
 
-// 解析请求数据
-bool HttpRequest::parse(Buffer& buff) {
-    const char CRLF[] = "\r\n"; // WinOS换行结束符
+bool HttpRequest::parse(Buffer& buff, bool deferBlocking) {
     if(buff.ReadableBytes() <= 0) {
         return false;
     }
-    // buff中有数据可读，并且状态没有到FINISH，就一直解析
-    while(buff.ReadableBytes() && state_ != FINISH) {
-        // 获取一行数据，根据\r\n为结束标志，Peek()就是R指针目前的位置，BeginWriteConst()就是W指针目前位置
-        const char* lineEnd = search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
-        std::string line(buff.Peek(), lineEnd); //这个line就是每一个请求行的字符串(不带\r\n)
+    // 请求跨了块才需要拷贝，之后[begin, end)是全部数据；数据被挪动过就把已经解析出的string_view跟着挪
+    const char* begin = buff.MakeContiguous();
+    const char* end = begin + buff.ReadableBytes();
+    if(base_ && base_ != begin) { Rebase_(begin); }
+    base_ = begin;
+    while(begin + pos_ < end && state_ != FINISH) {
+        const char* lineStart = begin + pos_;
+        if(state_ == BODY) {
+            if(deferBlocking && IsBlocking()) { break; }
+            // 请求体收够Content-Length个字节才处理
+            if(static_cast<size_t>(end - lineStart) < contentLength_) { break; }
+            ParseBody_(string_view(lineStart, contentLength_));
+            pos_ += contentLength_;
+            break;
+        }
+        // 找到\r\n；单独的\r、\n和其他控制字符都不合法
+        // 上次扫描过的、没有行尾的部分不再扫描
+        const char* lineEnd = ByteScanner::FindLineBreak(begin + std::max(pos_, scanned_), end);
+        if(lineEnd == end) {    // 这一行还没收全
+            scanned_ = end - begin;
+            break;
+        }
+        if(*lineEnd != '\r') { return false; }
+        if(lineEnd + 1 == end) {
+            scanned_ = lineEnd - begin;
+            break;
+        }
+        if(lineEnd[1] != '\n') { return false; }
+        string_view line(lineStart, lineEnd - lineStart);
+        pos_ = lineEnd + 2 - begin;
         switch(state_)
         {
         case REQUEST_LINE:
@@ -43,29 +112,37 @@ bool HttpRequest::parse(Buffer& buff) {
             }
             // 解析出请求资源路径，这个要单独列出
             ParsePath_();
-            break;    
+            break;
         case HEADERS:
-            // 解析请求头
-            ParseHeader_(line);
-            //如果解析完请求头之后只剩下\r\n，那就是get
-            if(buff.ReadableBytes() <= 2) {
-                state_ = FINISH;
+            if(line.empty()) {
+                // 空行，请求头结束；有Content-Length的接着收请求体
+                state_ = contentLength_ > 0 ? BODY : FINISH;
+            }
+            else if(!ParseHeader_(line)) {
+                return false;
             }
-            break;
-        case BODY:
-            // 解析请求体
-            ParseBody_(line);
             break;
         default:
             break;
         }
-        if(lineEnd == buff.BeginWrite()) { break; }
-        buff.RetrieveUntil(lineEnd + 2);
     }
-    LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
+    if(state_ == FINISH) {
+        LOG_DEBUG("[%.*s], [%s], [%.*s]", (int)method_.size(), method_.data(), path_.c_str(),
+                  (int)version_.size(), version_.data());
+    }
     return true;
 }
 
+// 缓冲区里的数据整体挪到了begin，请求行和请求头的string_view按偏移量重新指过去
+void HttpRequest::Rebase_(const char* begin) {
+    auto move = [this, begin](string_view v) {
+        return v.data() ? string_view(begin + (v.data() - base_), v.size()) : v;
+    };
+    method_ = move(method_);
+    version_ = move(version_);
+    header_.Rebase(move);
+}
+
 void HttpRequest::ParsePath_() {
     // 如果访问根目录，默认表示访问index.html
     // 例如 http://192.168.110.111:10000/
@@ -85,41 +162,81 @@ void HttpRequest::ParsePath_() {
 }
 
 //请求行的解析
-bool HttpRequest::ParseRequestLine_(const string& line) {
-    // GET / HTTP/1.1
-    regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    smatch subMatch;  //保存匹配结果，以()为组别,如subMatch[1]为第一个()中的子串
-    //如果成功匹配
-    if(regex_match(line, subMatch, patten)) {   
-        method_ = subMatch[1];
-        path_ = subMatch[2];
-        version_ = subMatch[3];
-        state_ = HEADERS;
-        return true;
+// GET / HTTP/1.1  方法是token，路径是可见字符，版本是HTTP/数字.数字，中间各一个空格
+bool HttpRequest::ParseRequestLine_(string_view line) {
+    size_t methodLen = Span(line, 0, TCHAR);
+    if(methodLen == 0 || methodLen >= line.size() || line[methodLen] != ' ') {
+        LOG_ERROR("RequestLine Error");
+        return false;
     }
-    LOG_ERROR("RequestLine Error");
-    return false;
+    size_t pathLen = Span(line, methodLen + 1, VCHAR);
+    size_t verPos = methodLen + 1 + pathLen;
+    if(pathLen == 0 || verPos >= line.size() || line[verPos] != ' ') {
+        LOG_ERROR("RequestLine Error");
+        return false;
+    }
+    string_view version = line.substr(verPos + 1);
+    if(version.size() != 8 || version.substr(0, 5) != "HTTP/" || !isdigit(version[5])
+        || version[6] != '.' || !isdigit(version[7])) {
+        LOG_ERROR("RequestLine Error");
+        return false;
+    }
+    method_ = line.substr(0, methodLen);
+    path_.assign(line.data() + methodLen + 1, pathLen);
+    version_ = version.substr(5);
+    // HTTP/1.1默认长连接，1.0要显式要求
+    isKeepAlive_ = version_ == "1.1";
+    state_ = HEADERS;
+    return true;
 }
 
 // Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.9
 // Connection: keep-alive
-void HttpRequest::ParseHeader_(const string& line) {
-    regex patten("^([^:]*): ?(.*)$");
-    smatch subMatch;
-    if(regex_match(line, subMatch, patten)) {
-        header_[subMatch[1]] = subMatch[2];
+// 名字是token，紧跟冒号；值去掉前后的空白(控制字符在找行尾时已经排除)；不支持折行(obs-fold)
+bool HttpRequest::ParseHeader_(string_view line) {
+    const char* colon = ByteScanner::FindAny(line.data(), line.data() + line.size(), ":", 1);
+    size_t nameLen = colon - line.data();
+    if(nameLen == 0 || nameLen == line.size() || Span(line, 0, TCHAR) != nameLen) {
+        LOG_ERROR("Header Error");
+        return false;
     }
-    else {
-        state_ = BODY;
+    string_view name = line.substr(0, nameLen);
+    string_view value = line.substr(nameLen + 1);
+    while(!value.empty() && (value.front() == ' ' || value.front() == '\t')) { value.remove_prefix(1); }
+    while(!value.empty() && (value.back() == ' ' || value.back() == '\t')) { value.remove_suffix(1); }
+    if(header_.Size() >= MAX_HEADERS) {
+        LOG_ERROR("Too many headers");
+        return false;
+    }
+    switch(header_.Add(name, value)) {
+    case HeaderTable::CONNECTION:
+        if(HeaderTable::EqualsNoCase(value, "keep-alive")) { isKeepAlive_ = true; }
+        else if(HeaderTable::EqualsNoCase(value, "close")) { isKeepAlive_ = false; }
+        break;
+    case HeaderTable::CONTENT_LENGTH:
+        // 只能是数字，不能太大
+        if(value.empty() || value.size() > 9 || Span(value, 0, DIGIT) != value.size()) {
+            LOG_ERROR("Content-Length Error");
+            return false;
+        }
+        contentLength_ = 0;
+        for(char ch: value) { contentLength_ = contentLength_ * 10 + (ch - '0'); }
+        break;
+    case HeaderTable::TRANSFER_ENCODING:
+        LOG_ERROR("Transfer-Encoding not supported");   // 不支持chunked请求体
+        return false;
+    default:
+        break;
     }
+    return true;
 }
 
-void HttpRequest::ParseBody_(const string& line) {
-    body_ = line;
+void HttpRequest::ParseBody_(string_view body) {
+    body_.assign(body);
     //请求体中都是POST提交的表单
     ParsePost_();
     state_ = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+    LOG_DEBUG("Body:%s, len:%d", body_.c_str(), body_.size());
 }
 
 // 将十六进制的字符，转换成十进制的整数
@@ -130,7 +247,7 @@ int HttpRequest::ConverHex(char ch) {
 }
 
 void HttpRequest::ParsePost_() {
-    if(method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
+    if(method_ == "POST" && GetHeader(HeaderTable::CONTENT_TYPE) == "application/x-www-form-urlencoded") {
         // 解析表单信息
         ParseFromUrlencoded_();
         if(DEFAULT_HTML_TAG.count(path_)) {
@@ -157,8 +274,10 @@ void HttpRequest::ParseFromUrlencoded_() {
     int n = body_.size();
     int i = 0, j = 0;
 
-    //就是把key，value分开
+    //就是把key，value分开，中间的普通字符成段跳过
     for(; i < n; i++) {
+        i = ByteScanner::FindAny(body_.data() + i, body_.data() + n, "=+%&", 4) - body_.data();
+        if(i == n) { break; }
         char ch = body_[i];
         switch (ch) {
         case '=':
@@ -170,6 +289,7 @@ void HttpRequest::ParseFromUrlencoded_() {
             break;
         case '%':  //如果是数据就编码加密
             // 简单的加密的操作，编码
+            if(i + 2 >= n) { break; }
             num = ConverHex(body_[i + 1]) * 16 + ConverHex(body_[i + 2]);
             body_[i + 2] = num % 10 + '0';
             body_[i + 1] = num / 10 + '0';
@@ -262,14 +382,22 @@ std::string HttpRequest::path() const{
 std::string& HttpRequest::path(){
     return path_;
 }
-std::string HttpRequest::method() const {
+std::string_view HttpRequest::method() const {
     return method_;
 }
 
-std::string HttpRequest::version() const {
+std::string_view HttpRequest::version() const {
     return version_;
 }
 
+std::string_view HttpRequest::GetHeader(std::string_view key) const {
+    return header_.Get(key);
+}
+
+std::string_view HttpRequest::GetHeader(HeaderTable::HEADER_ID id) const {
+    return header_.Get(id);
+}
+
 std::string HttpRequest::GetPost(const std::string& key) const {
     assert(key != "");
     if(post_.count(key) == 1) {
@@ -4,14 +4,17 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
-#include <regex>  /*正则表达式*/
+#include <string_view>
 #include <errno.h>     
+#include <ctype.h>     // tolower/isdigit
 #include <mysql/mysql.h>  //mysql
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/sqlconnRAII.h"
+#include "bytescanner.h"
+#include "headertable.h"
 
 //请求类里装的就是http请求数据
 class HttpRequest {
@@ -38,21 +41,35 @@ public:
     ~HttpRequest() = default;
 
     void Init();
-    bool parse(Buffer& buff);
+    void Shrink();  // 空闲时释放请求头、表单占用的内存
+    // 直接在buff的数据上解析，不取走数据；请求行、请求头以string_view指向buff，
+    // 所以响应生成完之前buff里的数据不能动，之后由连接取走Consumed()个字节。
+    // 数据不全时返回true但IsFinished()为false，收到更多数据后再调用会接着上次的位置解析，
+    // 一个请求完成以后要Init()才能解析下一个
+    // deferBlocking时解析到要查数据库的请求体之前停下(IsBlocking()为true)，换个线程不带它再调用接着解析
+    bool parse(Buffer& buff, bool deferBlocking = false);
+    size_t Consumed() const { return pos_; }
+    bool IsFinished() const { return state_ == FINISH; }
+    // 请求头已经解析完，请求体是登录/注册表单，处理时要查数据库
+    bool IsBlocking() const;
 
     std::string path() const;
     std::string& path();
-    std::string method() const;
-    std::string version() const;
+    std::string_view method() const;
+    std::string_view version() const;
+    std::string_view GetHeader(std::string_view key) const;   // 不区分大小写
+    std::string_view GetHeader(HeaderTable::HEADER_ID id) const;
     std::string GetPost(const std::string& key) const;
     std::string GetPost(const char* key) const;
 
     bool IsKeepAlive() const;
 
 private:
-    bool ParseRequestLine_(const std::string& line);
-    void ParseHeader_(const std::string& line);
-    void ParseBody_(const std::string& line);
+    bool ParseRequestLine_(std::string_view line);
+    bool ParseHeader_(std::string_view line);
+    void ParseBody_(std::string_view body);
+
+    void Rebase_(const char* begin);
 
     void ParsePath_();
     void ParsePost_();
@@ -60,11 +77,20 @@ private:
 
     static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);
 
+    // 解析状态跨多次读保留，数据没收全时下次从pos_接着解析
     PARSE_STATE state_;     // 解析的状态
-    std::string method_, path_, version_, body_;           // 请求行：请求方法，url路径，协议版本，请求体
-    std::unordered_map<std::string, std::string> header_;  // 请求头(键值对)
+    const char* base_;      // 上次解析时buff.Peek()的位置
+    size_t pos_;            // 已经解析到的位置(相对于buff.Peek())
+    size_t scanned_;        // 当前行已经扫描过、没有行尾的位置
+    size_t contentLength_;  // 请求体长度
+    bool isKeepAlive_;      // 请求头解析完时确定
+    std::string_view method_, version_;    // 请求行：请求方法，协议版本
+    std::string path_, body_;              // url路径(后面会改写)，请求体
+    HeaderTable header_;    // 请求头(键值对)
     std::unordered_map<std::string, std::string> post_;    // post请求表单数据(键值对)
 
+    static const size_t MAX_HEADERS = 100;  // 请求头太多的请求不处理
+
     static const std::unordered_set<std::string> DEFAULT_HTML;  // 默认的网页
     static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG; 
     static int ConverHex(char ch);  // 将十六进制字符转换成十进制整数
@@ -1,4 +1,7 @@
 #include "httpresponse.h"
+#include "headertable.h"
+#include "compresscache.h"
+#include <time.h>
 
 using namespace std;
 
@@ -21,16 +24,25 @@ const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
     { ".avi",   "video/x-msvideo" },
     { ".gz",    "application/x-gzip" },
     { ".tar",   "application/x-tar" },
-    { ".css",   "text/css "},
-    { ".js",    "text/javascript "},
+    { ".css",   "text/css" },
+    { ".js",    "text/javascript" },
+    { ".svg",   "image/svg+xml" },
+    { ".ttf",   "font/ttf" },
+    { ".otf",   "font/otf" },
+    { ".woff",  "font/woff" },
+    { ".woff2", "font/woff2" },
+    { ".eot",   "application/vnd.ms-fontobject" },
 };
 
 // 响应状态码对应的描述语
 const unordered_map<int, string> HttpResponse::CODE_STATUS = {
     { 200, "OK" },
+    { 206, "Partial Content" },
+    { 304, "Not Modified" },
     { 400, "Bad Request" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
+    { 416, "Range Not Satisfiable" },
 };
 
 // 响应码对应的资源路径
@@ -44,128 +56,353 @@ HttpResponse::HttpResponse() {
     code_ = -1;
     path_ = srcDir_ = "";
     isKeepAlive_ = false;
-    mmFile_ = nullptr; 
-    mmFileStat_ = { 0 };
+    acceptEncoding_ = 0;
+    onLoop_ = false;
+    prebuilt_ = nullptr;
 };
 
 HttpResponse::~HttpResponse() {
     UnmapFile();
 }
 
-void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code){
+void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code,
+                        string_view acceptEncoding){
     assert(srcDir != "");
     
-    if(mmFile_) { UnmapFile(); }
+    UnmapFile();
 
     code_ = code;
     isKeepAlive_ = isKeepAlive;
+    acceptEncoding_ = acceptEncoding.empty() ? 0 : ParseAcceptEncoding(acceptEncoding);
+    ifNoneMatch_ = ifModifiedSince_ = range_ = ifRange_ = string_view();
+    segments_.clear();
     path_ = path;
     srcDir_ = srcDir;
-    mmFile_ = nullptr; 
-    mmFileStat_ = { 0 };
+}
+
+void HttpResponse::SetConditions(string_view ifNoneMatch, string_view ifModifiedSince) {
+    ifNoneMatch_ = ifNoneMatch;
+    ifModifiedSince_ = ifModifiedSince;
+}
+
+void HttpResponse::SetRange(string_view range, string_view ifRange) {
+    range_ = range;
+    ifRange_ = ifRange;
 }
 
 void HttpResponse::MakeResponse(Buffer& buff) {
     /* 判断请求的资源文件 */
     // index.html
     // /home/nowcoder/WebServer-master/resources/index.html
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
+    string path = srcDir_ + path_;
+    // 条件请求在打开文件之前判断，客户端的版本还是新的就只回304响应头
+    if(code_ == 200 && (!ifNoneMatch_.empty() || !ifModifiedSince_.empty()) && NotModified_(path, buff)) {
+        return;
+    }
+    // 从文件缓存里取，常用的文件不用再stat/open/mmap
+    file_ = FileCache::Instance()->Get(path);
+    if(!file_) {    // 不存在、是目录或者打不开
         code_ = 404;
     }
-    else if(!(mmFileStat_.st_mode & S_IROTH)) {
+    else if(!(file_->st.st_mode & S_IROTH)) {
         code_ = 403;
     }
     else if(code_ == -1) { 
         code_ = 200; 
     }
+    if(code_ == 200) {
+        // 请求一部分时发原文件的那几段，不压缩
+        if(!range_.empty() && RangeApplies_() && AddRanges_(buff)) { return; }
+        // 客户端接受的话发预压缩版本，br比gzip小，优先用
+        for(int enc = FileEntry::ENCODING_COUNT - 1; enc > FileEntry::IDENTITY; enc--) {
+            if((acceptEncoding_ & (1 << enc)) && file_->variant[enc]) {
+                file_ = file_->variant[enc];
+                break;
+            }
+        }
+        // 没有预压缩文件就现场gzip，结果缓存起来；事件循环线程里没命中先发原文件
+        if(file_->encoding == FileEntry::IDENTITY && (acceptEncoding_ & (1 << FileEntry::GZIP))) {
+            FilePtr gzip = CompressCache::Instance()->Get(file_, !onLoop_);
+            if(gzip) { file_ = gzip; }
+        }
+        // 热点文件的响应头都一样，直接用缓存里生成好的
+        prebuilt_ = &file_->head[isKeepAlive_];
+        return;
+    }
     ErrorHtml_();
-    AddStateLine_(buff);
-    AddHeader_(buff);
+    if(CODE_STATUS.count(code_) == 0) { code_ = 400; }
+    buff.Append(MakeHead(code_, isKeepAlive_, file_ ? file_->mime : MimeType(path_)));
     AddContent_(buff);
 }
 
-char* HttpResponse::File() {
-    return mmFile_;
+const char* HttpResponse::File() const {
+    return file_ ? file_->map : nullptr;
 }
 
 size_t HttpResponse::FileLen() const {
-    return mmFileStat_.st_size;
+    return file_ ? file_->size : 0;
 }
 
-void HttpResponse::ErrorHtml_() {
-    if(CODE_PATH.count(code_) == 1) {
-        path_ = CODE_PATH.find(code_)->second;
-        stat((srcDir_ + path_).data(), &mmFileStat_);
+string_view HttpResponse::PrebuiltHead() const {
+    return prebuilt_ ? string_view(*prebuilt_) : string_view();
+}
+
+// 元数据从文件缓存里取，没缓存只stat，不打开文件
+bool HttpResponse::NotModified_(const string& path, Buffer& buff) {
+    FilePtr entry;
+    struct stat st;
+    if(!FileCache::Instance()->Stat(path, entry, st) || !(st.st_mode & S_IROTH)) { return false; }
+    string etag = entry ? entry->etag : FileEntry::MakeETag(st);
+    string_view matched;
+    if(!ifNoneMatch_.empty()) {
+        // 有If-None-Match时不看If-Modified-Since
+        matched = MatchETag(ifNoneMatch_, etag);
+        if(matched.empty()) { return false; }
+    } else {
+        struct tm tm = {};
+        const char* end = strptime(string(ifModifiedSince_).data(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        if(!end || st.st_mtim.tv_sec > timegm(&tm)) { return false; }
     }
+    code_ = 304;
+    string mime = entry ? entry->mime : MimeType(path_);
+    string head = MakeHead(code_, isKeepAlive_, mime);
+    head += "ETag: " + (matched.empty() || matched == "*" ? etag : string(matched)) + "\r\n";
+    head += "Last-Modified: " + (entry ? entry->lastModified : FileEntry::HttpDate(st.st_mtim.tv_sec)) + "\r\n";
+    if(IsCompressible(mime)) { head += "Vary: Accept-Encoding\r\n"; }
+    head += "\r\n";
+    buff.Append(head);
+    return true;
 }
 
-// 添加响应状态行
-void HttpResponse::AddStateLine_(Buffer& buff) {
-    string status;
-    if(CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
+// 有If-Range时文件没变才按Range发，否则发整个文件；只认强ETag或者完全相同的Last-Modified
+bool HttpResponse::RangeApplies_() const {
+    if(ifRange_.empty()) { return true; }
+    if(ifRange_[0] == '"' || ifRange_.substr(0, 2) == "W/") { return ifRange_ == file_->etag; }
+    return ifRange_ == file_->lastModified;
+}
+
+// Range不能用(格式不对、段太多)返回false
+bool HttpResponse::AddRanges_(Buffer& buff) {
+    if(!ParseRange(range_, file_->size, segments_)) {
+        segments_.clear();
+        return false;
+    }
+    string total = to_string(file_->size);
+    if(segments_.empty()) {
+        code_ = 416;
+        buff.Append(MakeHead(code_, isKeepAlive_, file_->mime) + "Content-Range: bytes */" + total
+                    + "\r\nContent-length: 0\r\n\r\n");
+        file_.reset();
+        return true;
     }
-    else {
-        code_ = 400;
-        status = CODE_STATUS.find(400)->second;
+    code_ = 206;
+    string common = "Accept-Ranges: bytes\r\nETag: " + file_->etag + "\r\nLast-Modified: " + file_->lastModified + "\r\n";
+    if(IsCompressible(file_->mime)) { common += "Vary: Accept-Encoding\r\n"; }
+    auto contentRange = [&](const Segment& seg) {
+        return "Content-Range: bytes " + to_string(seg.offset) + "-" + to_string(seg.offset + seg.len - 1)
+            + "/" + total + "\r\n";
+    };
+    if(segments_.size() == 1) {
+        string head = MakeHead(code_, isKeepAlive_, file_->mime) + common + contentRange(segments_[0])
+            + "Content-length: " + to_string(segments_[0].len) + "\r\n\r\n";
+        buff.Append(head);
+        segments_[0].headLen = head.size();
+        return true;
     }
-    buff.Append("HTTP/1.1 " + to_string(code_) + " " + status + "\r\n");
+    // 多段：multipart/byteranges，每段前面是分隔行和这段的Content-type、Content-Range
+    string boundary = "range_" + file_->etag.substr(1, file_->etag.size() - 2);
+    vector<string> parts;
+    size_t length = 0;
+    for(const Segment& seg: segments_) {
+        parts.push_back("\r\n--" + boundary + "\r\nContent-type: " + file_->mime + "\r\n" + contentRange(seg) + "\r\n");
+        length += parts.back().size() + seg.len;
+    }
+    string tail = "\r\n--" + boundary + "--\r\n";
+    length += tail.size();
+    string head = MakeHead(code_, isKeepAlive_, "multipart/byteranges; boundary=" + boundary) + common
+        + "Content-length: " + to_string(length) + "\r\n\r\n";
+    buff.Append(head);
+    for(size_t i = 0; i < parts.size(); i++) {
+        buff.Append(parts[i]);
+        segments_[i].headLen = parts[i].size() + (i == 0 ? head.size() : 0);
+    }
+    buff.Append(tail);
+    segments_.push_back({ tail.size(), 0, 0 });
+    return true;
 }
 
-// 添加响应头
-void HttpResponse::AddHeader_(Buffer& buff) {
-    buff.Append("Connection: ");
-    if(isKeepAlive_) {
-        buff.Append("keep-alive\r\n");
-        buff.Append("keep-alive: max=6, timeout=120\r\n");
-    } else{
-        buff.Append("close\r\n");
+void HttpResponse::ErrorHtml_() {
+    if(CODE_PATH.count(code_) == 1) {
+        path_ = CODE_PATH.find(code_)->second;
+        file_ = FileCache::Instance()->Get(srcDir_ + path_);
     }
-    buff.Append("Content-type: " + GetFileType_() + "\r\n");
 }
 
-// 添加响应体
-void HttpResponse::AddContent_(Buffer& buff) {
-    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
-    if(srcFd < 0) { 
-        ErrorContent(buff, "File NotFound!");
-        return; 
+string HttpResponse::MakeHead(int code, bool isKeepAlive, const string& mime) {
+    string head = "HTTP/1.1 " + to_string(code) + " " + CODE_STATUS.find(code)->second + "\r\n";
+    head += "Connection: ";
+    if(isKeepAlive) {
+        head += "keep-alive\r\n";
+        head += "keep-alive: max=6, timeout=120\r\n";
+    } else{
+        head += "close\r\n";
     }
+    head += "Content-type: " + mime + "\r\n";
+    return head;
+}
 
-    /* 将文件映射到内存提高文件的访问速度 
-        MAP_PRIVATE 建立一个写入时拷贝的私有映射*/
-    LOG_DEBUG("file path %s", (srcDir_ + path_).data());
-    int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
-    if(*mmRet == -1) {
+// 添加响应体，文件内容由发送队列直接从缓存的映射里发
+void HttpResponse::AddContent_(Buffer& buff) {
+    if(!file_) {
         ErrorContent(buff, "File NotFound!");
         return; 
     }
-    mmFile_ = (char*)mmRet;
-    close(srcFd);
-    buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+    LOG_DEBUG("file path %s", file_->path.data());
+    buff.Append("Content-length: " + to_string(file_->size) + "\r\n\r\n");
 }
 
-// 解除内存映射
 void HttpResponse::UnmapFile() {
-    if(mmFile_) {
-        munmap(mmFile_, mmFileStat_.st_size);
-        mmFile_ = nullptr;
-    }
+    file_.reset();
+    prebuilt_ = nullptr;
+}
+
+FilePtr HttpResponse::ReleaseFile() {
+    prebuilt_ = nullptr;
+    return std::move(file_);
+}
+
+void HttpResponse::Shrink() {
+    UnmapFile();
+    string().swap(path_);
+    string().swap(srcDir_);
 }
 
-string HttpResponse::GetFileType_() {
+string HttpResponse::MimeType(const string& path) {
     /* 判断文件类型 */
-    string::size_type idx = path_.find_last_of('.');
+    string::size_type idx = path.find_last_of('.');
     if(idx == string::npos) {
         return "text/plain";
     }
-    string suffix = path_.substr(idx);
+    string suffix = path.substr(idx);
     if(SUFFIX_TYPE.count(suffix) == 1) {
         return SUFFIX_TYPE.find(suffix)->second;
     }
     return "text/plain";
 }
 
+bool HttpResponse::IsCompressible(const string& mime) {
+    return mime.compare(0, 5, "text/") == 0 || mime == "application/xhtml+xml" || mime == "application/rtf"
+        || mime == "image/svg+xml" || mime == "font/ttf" || mime == "font/otf"
+        || mime == "application/vnd.ms-fontobject";
+}
+
+namespace {
+string_view Trim(string_view s) {
+    while(!s.empty() && (s.front() == ' ' || s.front() == '\t')) { s.remove_prefix(1); }
+    while(!s.empty() && (s.back() == ' ' || s.back() == '\t')) { s.remove_suffix(1); }
+    return s;
+}
+
+// q=0、q=0.0之类表示明确不接受
+bool IsZeroQ(string_view params) {
+    size_t q = params.find("q=");
+    if(q == string_view::npos) { return false; }
+    string_view v = Trim(params.substr(q + 2));
+    if(v.empty() || v[0] != '0') { return false; }
+    for(size_t i = 1; i < v.size(); i++) {
+        if(v[i] != '.' && v[i] != '0') { return v[i] == ';' || v[i] == ' '; }
+    }
+    return true;
+}
+}
+
+// 例如 "gzip, deflate, br;q=0.9, *;q=0"
+int HttpResponse::ParseAcceptEncoding(string_view value) {
+    int accepted = 0, rejected = 0, others = 0;
+    while(!value.empty()) {
+        size_t comma = value.find(',');
+        string_view item = value.substr(0, comma);
+        value = comma == string_view::npos ? string_view() : value.substr(comma + 1);
+        size_t semi = item.find(';');
+        string_view coding = Trim(item.substr(0, semi));
+        bool zero = semi != string_view::npos && IsZeroQ(item.substr(semi + 1));
+        if(coding == "*") {
+            if(!zero) { others = ~0; }
+            continue;
+        }
+        for(int enc = FileEntry::GZIP; enc < FileEntry::ENCODING_COUNT; enc++) {
+            if(HeaderTable::EqualsNoCase(coding, FileEntry::ENCODING_NAME[enc])) {
+                (zero ? rejected : accepted) |= 1 << enc;
+            }
+        }
+    }
+    int all = ((1 << FileEntry::ENCODING_COUNT) - 1) & ~(1 << FileEntry::IDENTITY);
+    return (accepted | (others & ~rejected)) & ~rejected & all;
+}
+
+// 例如 "abc", W/"abc+gz"，If-None-Match用弱比较
+string_view HttpResponse::MatchETag(string_view ifNoneMatch, const string& etag) {
+    string_view base(etag.data(), etag.size() - 1);     // 去掉结尾的引号
+    while(!ifNoneMatch.empty()) {
+        size_t comma = ifNoneMatch.find(',');
+        string_view tag = Trim(ifNoneMatch.substr(0, comma));
+        ifNoneMatch = comma == string_view::npos ? string_view() : ifNoneMatch.substr(comma + 1);
+        if(tag == "*") { return tag; }
+        if(tag.substr(0, 2) == "W/") { tag.remove_prefix(2); }
+        if(tag.size() < 2 || tag.back() != '"' || tag.substr(0, base.size()) != base) { continue; }
+        if(tag.size() == base.size() + 1 || tag[base.size()] == '+') { return tag; }
+    }
+    return string_view();
+}
+
+namespace {
+bool ParseSize(string_view s, size_t& n) {
+    if(s.empty() || s.size() > 18) { return false; }
+    n = 0;
+    for(char c: s) {
+        if(c < '0' || c > '9') { return false; }
+        n = n * 10 + (c - '0');
+    }
+    return true;
+}
+}
+
+// 例如 "bytes=0-499, 1000-, -200"
+bool HttpResponse::ParseRange(string_view value, size_t size, vector<Segment>& ranges) {
+    ranges.clear();
+    value = Trim(value);
+    if(value.substr(0, 6) != "bytes=") { return false; }
+    value.remove_prefix(6);
+    size_t count = 0;
+    while(!value.empty()) {
+        size_t comma = value.find(',');
+        string_view spec = Trim(value.substr(0, comma));
+        value = comma == string_view::npos ? string_view() : value.substr(comma + 1);
+        if(spec.empty()) { continue; }
+        if(++count > MAX_RANGES) { return false; }
+        size_t dash = spec.find('-');
+        if(dash == string_view::npos) { return false; }
+        string_view first = Trim(spec.substr(0, dash));
+        string_view last = Trim(spec.substr(dash + 1));
+        size_t begin, end;
+        if(first.empty()) {
+            // 最后n个字节
+            if(!ParseSize(last, end)) { return false; }
+            if(end == 0 || size == 0) { continue; }
+            begin = end >= size ? 0 : size - end;
+            end = size - 1;
+        } else {
+            if(!ParseSize(first, begin)) { return false; }
+            if(last.empty()) { end = size - 1; }
+            else if(!ParseSize(last, end) || end < begin) { return false; }
+            if(begin >= size) { continue; }     // 这一段不能满足
+            end = std::min(end, size - 1);
+        }
+        ranges.push_back({ 0, static_cast<off_t>(begin), end - begin + 1 });
+    }
+    return count > 0;
+}
+
 void HttpResponse::ErrorContent(Buffer& buff, string message) 
 {
     string body;
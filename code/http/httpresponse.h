@@ -2,6 +2,8 @@
 #define HTTP_RESPONSE_H
 
 #include <unordered_map>
+#include <string_view>
+#include <vector>
 #include <fcntl.h>       // open
 #include <unistd.h>      // close
 #include <sys/stat.h>    // stat
@@ -9,40 +11,82 @@
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "filecache.h"
 
 class HttpResponse {
 public:
     HttpResponse();
     ~HttpResponse();
 
-    void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
+    void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1,
+              std::string_view acceptEncoding = std::string_view());
+    // 条件请求头，Init之后、MakeResponse之前设置，要在MakeResponse返回前保持有效
+    void SetConditions(std::string_view ifNoneMatch, std::string_view ifModifiedSince);
+    void SetRange(std::string_view range, std::string_view ifRange);
+    // 在事件循环线程里生成响应：现场压缩没命中时不等压缩，先发原文件
+    void SetOnLoop(bool onLoop) { onLoop_ = onLoop; }
     void MakeResponse(Buffer& buff);
-    void UnmapFile();
-    char* File();
+    void UnmapFile();       // 放掉对缓存文件的引用
+    FilePtr ReleaseFile();  // 把文件的引用交给调用者(发送队列)
+    void Shrink();  // 空闲时放掉文件，释放路径占用的内存
+    const char* File() const;
     size_t FileLen() const;
+    // 文件缓存里预先生成的响应头，用上了MakeResponse就不往buff里写响应头；为空表示响应头在buff里
+    std::string_view PrebuiltHead() const;
+
+    // 206响应分段发：buff里按顺序headLen字节之后跟着文件的[offset, offset+len)，
+    // 多段时每段前面是分隔行和这段的头，最后一段只有结束的分隔行；不是206时为空
+    struct Segment {
+        size_t headLen;
+        off_t offset;
+        size_t len;
+    };
+    const std::vector<Segment>& Segments() const { return segments_; }
+
+    // 解析Range(只支持bytes)：格式不对或者段太多返回false(忽略Range发整个文件)，
+    // 能满足的段放进ranges(offset和len)，一段都不能满足时为空
+    static bool ParseRange(std::string_view value, size_t size, std::vector<Segment>& ranges);
+
+    static std::string MimeType(const std::string& path);   // 按后缀得到Content-type
+    static bool IsCompressible(const std::string& mime);    // 这种类型压缩了能不能明显变小
+    // Accept-Encoding里客户端接受的编码，按FileEntry::ENCODING的位，q=0的不算
+    static int ParseAcceptEncoding(std::string_view value);
+    // If-None-Match里和etag是同一个版本的标签(忽略W/和+编码后缀)，"*"返回"*"，没有返回空
+    static std::string_view MatchETag(std::string_view ifNoneMatch, const std::string& etag);
+    // 状态行和Content-length以外的响应头
+    static std::string MakeHead(int code, bool isKeepAlive, const std::string& mime);
     void ErrorContent(Buffer& buff, std::string message);
     int Code() const { return code_; }
+    bool IsKeepAlive() const { return isKeepAlive_; }
 
 private:
-    void AddStateLine_(Buffer &buff);
-    void AddHeader_(Buffer &buff);
     void AddContent_(Buffer &buff);
 
     void ErrorHtml_();
-    std::string GetFileType_();
+    bool NotModified_(const std::string& path, Buffer& buff);
+    bool RangeApplies_() const;
+    bool AddRanges_(Buffer& buff);
 
     int code_;  // 响应状态码
     bool isKeepAlive_;  // 是否保持连接
+    int acceptEncoding_;    // 客户端接受的编码(按位)
+    bool onLoop_;           // 在事件循环线程里，不现场压缩
+    std::string_view ifNoneMatch_;      // 指向请求里的值
+    std::string_view ifModifiedSince_;
+    std::string_view range_;
+    std::string_view ifRange_;
+    std::vector<Segment> segments_;
 
     std::string path_;  // 资源的路径
     std::string srcDir_;    // 资源的目录
     
-    char* mmFile_;  // 文件内存映射的指针
-    struct stat mmFileStat_;    // 文件的状态信息
+    FilePtr file_;  // 文件缓存里的条目(fd、映射、stat、类型、预先生成的响应头)
+    const std::string* prebuilt_;   // 用的是file_里的哪个响应头
 
     static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;  // 后缀 - 类型
     static const std::unordered_map<int, std::string> CODE_STATUS;    // 状态码 - 描述 
     static const std::unordered_map<int, std::string> CODE_PATH;      // 状态码 - 路径
+    static const size_t MAX_RANGES = 16;    // 一个请求最多的段数，再多就发整个文件
 };
 
 
@@ -0,0 +1,133 @@
+#include "precompress.h"
+#include "filecache.h"
+#include "httpresponse.h"
+#include <dirent.h>
+#include <string.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+
+namespace {
+bool ReadFile(const std::string& path, std::string& data) {
+    int fd = open(path.data(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { return false; }
+    char buf[65536];
+    ssize_t n;
+    data.clear();
+    while((n = read(fd, buf, sizeof(buf))) > 0) { data.append(buf, n); }
+    close(fd);
+    return n == 0;
+}
+
+// 先写临时文件再rename，读的一方不会看到写了一半的文件
+bool WriteFile(const std::string& path, const std::string& data) {
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) { return false; }
+    size_t done = 0;
+    while(done < data.size()) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if(n <= 0) { break; }
+        done += n;
+    }
+    close(fd);
+    if(done != data.size() || rename(tmp.data(), path.data()) < 0) {
+        unlink(tmp.data());
+        return false;
+    }
+    return true;
+}
+
+bool HasSuffix(const std::string& s, const char* suffix) {
+    size_t len = strlen(suffix);
+    return s.size() >= len && s.compare(s.size() - len, len, suffix) == 0;
+}
+
+// path存在并且不比源文件旧
+bool IsFresh(const std::string& path, const struct stat& src) {
+    struct stat st;
+    return stat(path.data(), &st) == 0 && (st.st_mtim.tv_sec > src.st_mtim.tv_sec
+        || (st.st_mtim.tv_sec == src.st_mtim.tv_sec && st.st_mtim.tv_nsec >= src.st_mtim.tv_nsec));
+}
+}
+
+bool Precompressor::Gzip(const std::string& in, std::string& out, int level) {
+    z_stream z = {};
+    // windowBits加16输出gzip格式
+    if(deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) { return false; }
+    out.resize(deflateBound(&z, in.size()));
+    z.next_in = (Bytef*)in.data();
+    z.avail_in = in.size();
+    z.next_out = (Bytef*)&out[0];
+    z.avail_out = out.size();
+    int ret = deflate(&z, Z_FINISH);
+    out.resize(z.total_out);
+    deflateEnd(&z);
+    return ret == Z_STREAM_END;
+}
+
+bool Precompressor::Brotli(const std::string& in, std::string& out, bool font, int quality) {
+    size_t outSize = BrotliEncoderMaxCompressedSize(in.size());
+    if(outSize == 0) { return false; }
+    out.resize(outSize);
+    if(!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, font ? BROTLI_MODE_FONT : BROTLI_MODE_TEXT,
+                              in.size(), (const uint8_t*)in.data(), &outSize, (uint8_t*)&out[0])) {
+        return false;
+    }
+    out.resize(outSize);
+    return true;
+}
+
+int Precompressor::Run(const std::string& dir) {
+    DIR* d = opendir(dir.data());
+    if(!d) { return 0; }
+    int count = 0;
+    struct dirent* ent;
+    while((ent = readdir(d)) != nullptr) {
+        if(ent->d_name[0] == '.') { continue; }     // 隐藏文件、.和..
+        std::string path = dir + "/" + ent->d_name;   // 和HttpResponse拼的一样(srcDir + /路径)，失效时对得上缓存的键
+        struct stat st;
+        if(stat(path.data(), &st) < 0) { continue; }
+        if(S_ISDIR(st.st_mode)) { count += Run(path); }
+        else if(S_ISREG(st.st_mode)) { count += CompressFile_(path); }
+    }
+    closedir(d);
+    return count;
+}
+
+int Precompressor::CompressFile_(const std::string& path) {
+    for(int enc = FileEntry::GZIP; enc < FileEntry::ENCODING_COUNT; enc++) {
+        if(HasSuffix(path, FileEntry::ENCODING_SUFFIX[enc]) || HasSuffix(path, ".tmp")
+           || HasSuffix(path, NO_GAIN_SUFFIX)) { return 0; }
+    }
+    std::string mime = HttpResponse::MimeType(path);
+    if(!HttpResponse::IsCompressible(mime)) { return 0; }
+    struct stat src;
+    if(stat(path.data(), &src) < 0) { return 0; }
+
+    std::string data, out;
+    int count = 0;
+    bool removed = false;
+    for(int enc = FileEntry::GZIP; enc < FileEntry::ENCODING_COUNT; enc++) {
+        std::string target = path + FileEntry::ENCODING_SUFFIX[enc];
+        std::string noGain = target + NO_GAIN_SUFFIX;
+        if(IsFresh(target, src) || IsFresh(noGain, src)) { continue; }    // 已经是新的，或者上次压缩没变小
+        if(data.empty() && !ReadFile(path, data)) { return count; }
+        bool ok = enc == FileEntry::GZIP ? Gzip(data, out)
+                                         : Brotli(data, out, mime.compare(0, 5, "font/") == 0);
+        if(!ok) { continue; }
+        if(out.size() < data.size()) {
+            if(WriteFile(target, out)) {
+                unlink(noGain.data());
+                count++;
+            }
+        } else {
+            // 压缩后没变小就不要了，请求时发原文件；旧的预压缩文件删掉，记下这次的结果
+            // 标记的mtime设成源文件的，源文件的时间在将来也不会每次都重新压缩
+            removed |= unlink(target.data()) == 0;
+            struct timespec times[2] = { src.st_mtim, src.st_mtim };
+            if(WriteFile(noGain, "")) { utimensat(AT_FDCWD, noGain.data(), times, 0); }
+        }
+    }
+    if(count || removed) { FileCache::Instance()->Invalidate(path); }
+    return count;
+}
@@ -0,0 +1,23 @@
+#ifndef PRECOMPRESS_H
+#define PRECOMPRESS_H
+
+#include <string>
+
+// 给静态资源生成预压缩文件：能压缩的文件旁边写上.gz/.br，已经有并且不比源文件旧的跳过
+// 压缩了不变小的写一个空的标记文件(如a.txt.gz.nogain)，源文件没改过就不再重复压缩
+// 服务器启动时在后台线程里跑一遍，也可以离线提前生成好；写完让文件缓存重新加载这个文件
+class Precompressor {
+public:
+    static constexpr const char* NO_GAIN_SUFFIX = ".nogain";
+
+    // 处理dir下(包括子目录)所有文件，返回新生成的文件数
+    static int Run(const std::string& dir);
+
+    static bool Gzip(const std::string& in, std::string& out, int level = 9);
+    static bool Brotli(const std::string& in, std::string& out, bool font = false, int quality = 11);
+
+private:
+    static int CompressFile_(const std::string& path);
+};
+
+#endif //PRECOMPRESS_H
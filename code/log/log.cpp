@@ -121,6 +121,7 @@ void Log::write(int level, const char *format, ...) {
     {
         unique_lock<mutex> locker(mtx_);
         lineCount_++;
+        buff_.EnsureWriteable(128);
         int n = snprintf(buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
                     t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
                     t.tm_hour, t.tm_min, t.tm_sec, now.tv_usec);
@@ -131,6 +132,13 @@ void Log::write(int level, const char *format, ...) {
         va_start(vaList, format);
         int m = vsnprintf(buff_.BeginWrite(), buff_.WritableBytes(), format, vaList);
         va_end(vaList);
+        if(m >= 0 && static_cast<size_t>(m) >= buff_.WritableBytes()) {
+            // 当前块放不下，换一块够大的重新格式化
+            buff_.EnsureWriteable(m + 1);
+            va_start(vaList, format);
+            vsnprintf(buff_.BeginWrite(), buff_.WritableBytes(), format, vaList);
+            va_end(vaList);
+        }
 
         buff_.HasWritten(m);
         buff_.Append("\n\0", 2);
@@ -138,7 +146,7 @@ void Log::write(int level, const char *format, ...) {
         if(isAsync_ && deque_ && !deque_->full()) {
             deque_->push_back(buff_.RetrieveAllToStr());
         } else {
-            fputs(buff_.Peek(), fp_);
+            fputs(buff_.MakeContiguous(), fp_);
         }
         buff_.RetrieveAll();
     }
@@ -8,7 +8,10 @@ int main() {
     WebServer server(
         1316, 3, 60000, false,             /* 端口 ET模式 timeoutMs=60s 优雅退出  */
         3306, "root", "root", "webserver", /* Mysql配置 */
-        12, 6, true, 1, 1024);             /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        12, 6, true, 1, 1024,              /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        false, 0, false, false, true, 6, true);  /* 多reactor模式(每个线程一个事件循环，线程数同线程池数量) IO后端(0:epoll 1:io_uring) 小请求在事件循环线程直接处理
+                                                    文件用sendfile发(否则mmap+writev) 启动时生成.gz/.br预压缩文件 没有预压缩文件时现场gzip的级别(0关闭)
+                                                    用inotify监视资源目录更新缓存 */
     
     
     // 启动服务器
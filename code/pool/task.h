@@ -0,0 +1,142 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <new>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <type_traits>
+#include <assert.h>
+
+// 线程池的任务类型：只能移动，不能复制
+// 可调用对象不超过INLINE_SIZE字节时直接存放在Task内部，构造和移动都不分配内存；
+// 平凡可复制的小对象(比如 连接指针+操作 这样的读写任务)移动时直接memcpy，也不需要析构。
+// 只有放不下的大对象才退回到堆上
+class Task {
+public:
+    static const size_t INLINE_SIZE = 48;
+
+    Task() noexcept : ops_(nullptr) {}
+
+    Task(std::nullptr_t) noexcept : ops_(nullptr) {}
+
+    template<class F, class = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) : ops_(nullptr) {
+        typedef typename std::decay<F>::type Fn;
+        Construct_<Fn>(std::forward<F>(f), std::integral_constant<bool, IsInline_<Fn>()>());
+    }
+
+    Task(Task&& other) noexcept : ops_(nullptr) {
+        MoveFrom_(other);
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if(this != &other) {
+            Reset_();
+            MoveFrom_(other);
+        }
+        return *this;
+    }
+
+    Task& operator=(std::nullptr_t) noexcept {
+        Reset_();
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { Reset_(); }
+
+    void operator()() {
+        assert(ops_);
+        ops_->invoke(storage_);
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+private:
+    // 每种可调用对象一张操作表，move/destroy为nullptr表示直接memcpy/不用析构
+    struct Ops {
+        void (*invoke)(void* self);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* self);
+    };
+
+    template<class Fn>
+    static constexpr bool IsInline_() {
+        return sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template<class Fn>
+    static constexpr bool IsTrivial_() {
+        return std::is_trivially_copyable<Fn>::value && std::is_trivially_destructible<Fn>::value;
+    }
+
+    /* 放在内部 */
+    template<class Fn>
+    struct InlineOps {
+        static void Invoke(void* self) { (*static_cast<Fn*>(self))(); }
+        static void Move(void* dst, void* src) {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        }
+        static void Destroy(void* self) { static_cast<Fn*>(self)->~Fn(); }
+        static const Ops ops;
+    };
+
+    /* 放在堆上，内部只存指针 */
+    template<class Fn>
+    struct HeapOps {
+        static void Invoke(void* self) { (**static_cast<Fn**>(self))(); }
+        static void Destroy(void* self) { delete *static_cast<Fn**>(self); }
+        static const Ops ops;
+    };
+
+    template<class Fn, class F>
+    void Construct_(F&& f, std::true_type) {
+        new (storage_) Fn(std::forward<F>(f));
+        ops_ = &InlineOps<Fn>::ops;
+    }
+
+    template<class Fn, class F>
+    void Construct_(F&& f, std::false_type) {
+        *reinterpret_cast<Fn**>(storage_) = new Fn(std::forward<F>(f));
+        ops_ = &HeapOps<Fn>::ops;
+    }
+
+    void MoveFrom_(Task& other) noexcept {
+        if(!other.ops_) { return; }
+        if(other.ops_->move) { other.ops_->move(storage_, other.storage_); }
+        else { memcpy(storage_, other.storage_, INLINE_SIZE); }
+        ops_ = other.ops_;
+        other.ops_ = nullptr;
+    }
+
+    void Reset_() noexcept {
+        if(ops_ && ops_->destroy) { ops_->destroy(storage_); }
+        ops_ = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[INLINE_SIZE];
+    const Ops* ops_;
+};
+
+template<class Fn>
+const Task::Ops Task::InlineOps<Fn>::ops = {
+    &Task::InlineOps<Fn>::Invoke,
+    Task::IsTrivial_<Fn>() ? nullptr : &Task::InlineOps<Fn>::Move,
+    Task::IsTrivial_<Fn>() ? nullptr : &Task::InlineOps<Fn>::Destroy,
+};
+
+/* 堆上的对象移动时只移动指针 */
+template<class Fn>
+const Task::Ops Task::HeapOps<Fn>::ops = {
+    &Task::HeapOps<Fn>::Invoke,
+    nullptr,
+    &Task::HeapOps<Fn>::Destroy,
+};
+
+#endif //TASK_H
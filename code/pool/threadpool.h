@@ -3,33 +3,121 @@
 
 #include <mutex>
 #include <condition_variable>
-#include <queue>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <memory>
 #include <thread>
-#include <functional>
+#include <assert.h>
+#include "task.h"
+
+// 有界的无锁队列(多生产者多消费者)，每个格子带一个序号，元素按值存放
+// 用作线程池的全局注入队列和每个工作线程的本地队列
+template<class T>
+class WorkQueue {
+public:
+    explicit WorkQueue(size_t capacity): cells_(new Cell[capacity]), mask_(capacity - 1) {
+        assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);  // 2的幂
+        for(size_t i = 0; i < capacity; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+        enqueuePos_.store(0, std::memory_order_relaxed);
+        dequeuePos_.store(0, std::memory_order_relaxed);
+    }
+
+    // 队列满了返回false，item不变
+    bool TryPush(T&& item) {
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while(true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if(diff == 0) {
+                if(enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) { break; }
+            }
+            else if(diff < 0) { return false; }
+            else { pos = enqueuePos_.load(std::memory_order_relaxed); }
+        }
+        cell->data = std::move(item);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 队列空了返回false
+    bool TryPop(T& item) {
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while(true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if(diff == 0) {
+                if(dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) { break; }
+            }
+            else if(diff < 0) { return false; }
+            else { pos = dequeuePos_.load(std::memory_order_relaxed); }
+        }
+        item = std::move(cell->data);
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Empty() const {
+        return enqueuePos_.load(std::memory_order_seq_cst) == dequeuePos_.load(std::memory_order_seq_cst);
+    }
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> enqueuePos_;    // 生产者和消费者的位置分在不同缓存行
+    alignas(64) std::atomic<size_t> dequeuePos_;
+};
+
+// 工作窃取线程池：
+// 事件循环把任务放进全局注入队列，工作线程先取自己的本地队列，再从全局队列批量取一些放到本地，
+// 都没有就去偷其他线程本地队列里的任务；还没有就先自旋一会儿，再睡在条件变量上。
+// 只有存在睡着的线程时AddTask才会加锁唤醒，线程都在忙时提交任务不碰锁
 class ThreadPool {
 public:
     //make_shared()是用来构造shared_ptr的
     explicit ThreadPool(size_t threadCount = 8): pool_(std::make_shared<Pool>()) {
             assert(threadCount > 0);
+            for(size_t i = 0; i < threadCount; i++) {
+                pool_->workers.emplace_back(new WorkQueue<Task>(LOCAL_CAPACITY));
+            }
 
             // 创建threadCount个子线程
             for(size_t i = 0; i < threadCount; i++) {
                 //使用lambda表达式创建线程
-                std::thread([pool = pool_] {
-                    std::unique_lock<std::mutex> locker(pool->mtx); //创建一个互斥锁
+                std::thread([pool = pool_, i] {
+                    Task task;
+                    int idle = 0;
                     while(true) {
-                        if(!pool->tasks.empty()) {
-                            auto task = std::move(pool->tasks.front()); // 从任务队列中取第一个任务
-                            pool->tasks.pop();   // 移除掉队列中第一个元素
-                            
-                            locker.unlock();  //解锁
-                            
+                        if(FindTask_(*pool, i, task)) {
                             task();  //调用任务函数
-                            
-                            locker.lock();   //加锁
-                        } 
-                        else if(pool->isClosed) break;
-                        else pool->cond.wait(locker);   // 如果队列为空，等待唤醒
+                            task = nullptr;
+                            idle = 0;
+                            continue;
+                        }
+                        if(pool->isClosed.load()) break;
+                        if(++idle < SPIN_COUNT) {  // 先自旋，短时间内很可能就有新任务
+                            std::this_thread::yield();
+                            continue;
+                        }
+                        // 睡眠前登记，再检查一次，和AddTask里的检查配对，不会丢失唤醒
+                        std::unique_lock<std::mutex> locker(pool->mtx);
+                        pool->sleeping.fetch_add(1);
+                        std::atomic_thread_fence(std::memory_order_seq_cst);
+                        if(!HasTask_(*pool) && !pool->isClosed.load()) {
+                            pool->cond.wait(locker);    // 如果队列为空，等待唤醒
+                        }
+                        pool->sleeping.fetch_sub(1);
+                        idle = 0;
                     }
                 }).detach();// 线程分离
             }
@@ -38,7 +126,7 @@ public:
     ThreadPool() = default;
 
     ThreadPool(ThreadPool&&) = default;
-    
+
     ~ThreadPool() {
         if(static_cast<bool>(pool_)) {
             {
@@ -51,23 +139,107 @@ public:
 
     template<class F>
     void AddTask(F&& task) {
+        Task t(std::forward<F>(task));
+        if(!pool_->global.TryPush(std::move(t))) {
+            // 全局队列满了放到加锁的溢出队列
+            std::lock_guard<std::mutex> locker(pool_->mtx);
+            pool_->overflow.push_back(std::move(t));
+            pool_->overflowSize.fetch_add(1);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(pool_->sleeping.load() > 0) {
+            { std::lock_guard<std::mutex> locker(pool_->mtx); }
+            pool_->cond.notify_one();   // 唤醒一个等待的线程
+        }
+    }
+
+    // 批量提交[first, last)里的任务(移动进来)：一次加锁，按任务数唤醒睡着的线程
+    // 事件循环用它把一次epoll_wait得到的所有读写任务一起交出去
+    template<class It>
+    void AddTasks(It first, It last) {
+        size_t n = 0;
+        for(; first != last; ++first, ++n) {
+            if(!pool_->global.TryPush(std::move(*first))) { break; }
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int sleeping = pool_->sleeping.load();
+        if(first == last && sleeping == 0) { return; }
         {
-            std::lock_guard<std::mutex> locker(pool_->mtx); //加锁
-            pool_->tasks.emplace(std::forward<F>(task));  //任务队列中添加一个任务，完美转发
+            std::lock_guard<std::mutex> locker(pool_->mtx);
+            for(; first != last; ++first, ++n) {
+                pool_->overflow.push_back(std::move(*first));
+                pool_->overflowSize.fetch_add(1);
+            }
+        }
+        if(static_cast<size_t>(sleeping) <= n) {
+            pool_->cond.notify_all();
+        } else {
+            for(size_t i = 0; i < n; i++) { pool_->cond.notify_one(); }
         }
-        pool_->cond.notify_one();   // 唤醒一个等待的线程
     }
 
 private:
+    static const size_t GLOBAL_CAPACITY = 4096;
+    static const size_t LOCAL_CAPACITY = 256;
+    static const size_t STEAL_BATCH = 8;    // 从全局队列一次取走的任务数
+    static const int SPIN_COUNT = 64;
+
     // 结构体
     struct Pool {
-        std::mutex mtx;     // 互斥锁
+        std::mutex mtx;     // 互斥锁，只用于睡眠/唤醒和溢出队列
         std::condition_variable cond;   // 条件变量
-        bool isClosed;          // 是否关闭
-        std::queue<std::function<void()>> tasks;    // 队列（保存的是任务）
+        std::atomic<bool> isClosed{false};  // 是否关闭
+        std::atomic<int> sleeping{0};       // 睡在条件变量上的线程数
+        WorkQueue<Task> global{GLOBAL_CAPACITY};    // 全局注入队列
+        std::vector<std::unique_ptr<WorkQueue<Task>>> workers;  // 每个工作线程的本地队列
+        std::deque<Task> overflow;          // 全局队列满时的溢出队列(mtx保护)
+        std::atomic<size_t> overflowSize{0};
     };
+
+    // 本地队列 -> 全局队列(顺便多取几个到本地) -> 偷其他线程 -> 溢出队列
+    static bool FindTask_(Pool& pool, size_t self, Task& task) {
+        WorkQueue<Task>& local = *pool.workers[self];
+        if(local.TryPop(task)) { return true; }
+        if(pool.global.TryPop(task)) {
+            Task more;
+            for(size_t n = 1; n < STEAL_BATCH && pool.global.TryPop(more); n++) {
+                // 本地队列是空的也可能放不下：偷任务的线程取走格子里的任务、还没把格子还回来时被抢占，
+                // 入队位置绕一圈回到这个格子就会失败。放不下的放进溢出队列，不能丢
+                if(!local.TryPush(std::move(more))) {
+                    std::lock_guard<std::mutex> locker(pool.mtx);
+                    pool.overflow.push_back(std::move(more));
+                    pool.overflowSize.fetch_add(1);
+                    break;
+                }
+            }
+            return true;
+        }
+        size_t n = pool.workers.size();
+        for(size_t i = 1; i < n; i++) {
+            if(pool.workers[(self + i) % n]->TryPop(task)) { return true; }
+        }
+        if(pool.overflowSize.load() > 0) {
+            std::lock_guard<std::mutex> locker(pool.mtx);
+            if(!pool.overflow.empty()) {
+                task = std::move(pool.overflow.front());
+                pool.overflow.pop_front();
+                pool.overflowSize.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool HasTask_(Pool& pool) {
+        if(!pool.global.Empty() || pool.overflowSize.load() > 0) { return true; }
+        for(auto& q: pool.workers) {
+            if(!q->Empty()) { return true; }
+        }
+        return false;
+    }
+
     std::shared_ptr<Pool> pool_;  //  池子指针
 };
 
 
-#endif //THREADPOOL_H
\ No newline at end of file
+#endif //THREADPOOL_H
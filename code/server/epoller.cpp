@@ -10,19 +10,19 @@ Epoller::~Epoller() {
 }
 
 // 添加文件描述符到epoll中进行管理
-bool Epoller::AddFd(int fd, uint32_t events) {
+bool Epoller::AddFd(int fd, uint32_t events, void* ptr) {
     if(fd < 0) return false;
     epoll_event ev = {0};
-    ev.data.fd = fd;
+    ev.data.ptr = ptr;
     ev.events = events;
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
 }
 
 // 修改
-bool Epoller::ModFd(int fd, uint32_t events) {
+bool Epoller::ModFd(int fd, uint32_t events, void* ptr) {
     if(fd < 0) return false;
     epoll_event ev = {0};
-    ev.data.fd = fd;
+    ev.data.ptr = ptr;
     ev.events = events;
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
 }
@@ -39,10 +39,10 @@ int Epoller::Wait(int timeoutMs) {
     return epoll_wait(epollFd_, &events_[0], static_cast<int>(events_.size()), timeoutMs);
 }
 
-// 获取产生事件的文件描述符
-int Epoller::GetEventFd(size_t i) const {
+// 获取产生事件的fd注册时带的指针
+void* Epoller::GetEventPtr(size_t i) const {
     assert(i < events_.size() && i >= 0);
-    return events_[i].data.fd;
+    return events_[i].data.ptr;
 }
 
 // 获取事件
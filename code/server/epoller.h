@@ -7,24 +7,25 @@
 #include <assert.h> // close()
 #include <vector>
 #include <errno.h>
+#include "poller.h"
 
-class Epoller {
+class Epoller : public Poller {
 public:
     explicit Epoller(int maxEvent = 1024);
 
-    ~Epoller();
+    ~Epoller() override;
 
-    bool AddFd(int fd, uint32_t events);
+    bool AddFd(int fd, uint32_t events, void* ptr) override;
 
-    bool ModFd(int fd, uint32_t events);
+    bool ModFd(int fd, uint32_t events, void* ptr) override;
 
-    bool DelFd(int fd);
+    bool DelFd(int fd) override;
 
-    int Wait(int timeoutMs = -1);
+    int Wait(int timeoutMs = -1) override;
 
-    int GetEventFd(size_t i) const;
+    void* GetEventPtr(size_t i) const override;
 
-    uint32_t GetEvents(size_t i) const;
+    uint32_t GetEvents(size_t i) const override;
         
 private:
     int epollFd_;   // epoll_create()创建一个epoll对象，返回值就是epollFd
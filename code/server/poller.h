@@ -0,0 +1,37 @@
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// IO事件后端的接口，事件的含义与epoll一致(EPOLLIN/EPOLLOUT/EPOLLONESHOT...)
+// 目前有两种实现：Epoller(epoll) 和 UringPoller(io_uring)，启动时选择
+// 注册时带一个ptr(相当于epoll_event.data.ptr)，事件发生时原样取回，不需要再按fd查表
+// 完成式的后端可以在事件里直接带上accept好的连接和读到的数据，省掉就绪之后的那次系统调用
+class Poller {
+public:
+    virtual ~Poller() = default;
+
+    virtual bool AddFd(int fd, uint32_t events, void* ptr) = 0;
+
+    virtual bool ModFd(int fd, uint32_t events, void* ptr) = 0;
+
+    virtual bool DelFd(int fd) = 0;
+
+    virtual int Wait(int timeoutMs = -1) = 0;
+
+    virtual void* GetEventPtr(size_t i) const = 0;
+
+    virtual uint32_t GetEvents(size_t i) const = 0;
+
+    // 监听fd：默认和普通fd一样，就绪后由调用者accept；io_uring用multishot accept直接交出新连接
+    virtual bool AddListenFd(int fd, uint32_t events) { return AddFd(fd, events, nullptr); }
+
+    // 第i个事件里已经accept好的连接，没有返回-1(调用者自己accept)
+    virtual int GetAcceptedFd(size_t /*i*/) const { return -1; }
+
+    // 第i个事件里已经收到的数据，没有返回0(调用者自己read)；数据在下一次Wait之前有效
+    virtual size_t GetData(size_t /*i*/, const char** /*data*/) const { return 0; }
+};
+
+#endif //POLLER_H
@@ -0,0 +1,395 @@
+#include "uringpoller.h"
+
+UringPoller::UringPoller(int maxEvent): ringFd_(-1), sqEntries_(0),
+    sqRing_(MAP_FAILED), sqRingSize_(0), cqRing_(MAP_FAILED), cqRingSize_(0),
+    sqes_(static_cast<io_uring_sqe*>(MAP_FAILED)), sqesSize_(0),
+    sqLocalTail_(0), events_(maxEvent), bufRing_(nullptr), bufs_(nullptr), bufTail_(0) {
+    assert(events_.size() > 0);
+    if(InitRing_(static_cast<unsigned>(maxEvent))) { InitBufRing_(); }
+}
+
+UringPoller::~UringPoller() {
+    FreeRing_();
+    FreeBufRing_();
+}
+
+// io_uring_setup()创建环，再把提交队列、完成队列和sqe数组映射到用户空间
+bool UringPoller::InitRing_(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    /* 完成队列开大一些，大量连接同时就绪时不溢出 */
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 16;
+    ringFd_ = syscall(__NR_io_uring_setup, entries, &p);
+    if(ringFd_ < 0) { return false; }
+    /* Wait的超时依赖IORING_ENTER_EXT_ARG(5.11+) */
+    if(!(p.features & IORING_FEAT_EXT_ARG)) {
+        FreeRing_();
+        return false;
+    }
+    sqEntries_ = p.sq_entries;
+    sqRingSize_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        if(cqRingSize_ > sqRingSize_) { sqRingSize_ = cqRingSize_; }
+        cqRingSize_ = sqRingSize_;
+    }
+    sqRing_ = mmap(0, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ringFd_, IORING_OFF_SQ_RING);
+    if(sqRing_ == MAP_FAILED) {
+        FreeRing_();
+        return false;
+    }
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ = mmap(0, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ringFd_, IORING_OFF_CQ_RING);
+        if(cqRing_ == MAP_FAILED) {
+            FreeRing_();
+            return false;
+        }
+    }
+    sqesSize_ = p.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(mmap(0, sqesSize_, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES));
+    if(sqes_ == MAP_FAILED) {
+        FreeRing_();
+        return false;
+    }
+    char* sq = static_cast<char*>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sqMask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    char* cq = static_cast<char*>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cqMask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    sqLocalTail_ = *sqTail_;
+    return true;
+}
+
+// 向内核注册provided buffer ring(5.19+)，recv完成时内核从里面挑一个缓冲区放数据
+bool UringPoller::InitBufRing_() {
+    void* ring = mmap(0, BUF_COUNT * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void* bufs = mmap(0, BUF_COUNT * BUF_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ring == MAP_FAILED || bufs == MAP_FAILED) {
+        if(ring != MAP_FAILED) { munmap(ring, BUF_COUNT * sizeof(io_uring_buf)); }
+        if(bufs != MAP_FAILED) { munmap(bufs, BUF_COUNT * BUF_SIZE); }
+        return false;
+    }
+    bufRing_ = static_cast<io_uring_buf_ring*>(ring);
+    bufs_ = static_cast<char*>(bufs);
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(bufRing_);
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid = BUF_GROUP;
+    if(syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        FreeBufRing_();
+        return false;
+    }
+    /* 一开始所有缓冲区都在环里 */
+    for(unsigned bid = 0; bid < BUF_COUNT; bid++) { used_.push_back(static_cast<uint16_t>(bid)); }
+    RecycleBufs_();
+    return true;
+}
+
+// 在FreeRing_之后调用：环关掉以后内核不再使用这些缓冲区
+void UringPoller::FreeBufRing_() {
+    if(bufRing_) { munmap(bufRing_, BUF_COUNT * sizeof(io_uring_buf)); }
+    if(bufs_) { munmap(bufs_, BUF_COUNT * BUF_SIZE); }
+    bufRing_ = nullptr;
+    bufs_ = nullptr;
+    used_.clear();
+}
+
+void UringPoller::FreeRing_() {
+    if(sqes_ != MAP_FAILED) { munmap(sqes_, sqesSize_); }
+    if(cqRing_ != MAP_FAILED && cqRing_ != sqRing_) { munmap(cqRing_, cqRingSize_); }
+    if(sqRing_ != MAP_FAILED) { munmap(sqRing_, sqRingSize_); }
+    sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+    sqRing_ = cqRing_ = MAP_FAILED;
+    if(ringFd_ >= 0) { close(ringFd_); }
+    ringFd_ = -1;
+}
+
+// 添加文件描述符，提交一个POLL_ADD或者recv
+bool UringPoller::AddFd(int fd, uint32_t events, void* ptr) {
+    if(fd < 0) return false;
+    std::lock_guard<std::mutex> locker(mtx_);
+    if(static_cast<size_t>(fd) >= interests_.size()) {
+        interests_.resize(fd + 1);
+    }
+    Interest& it = interests_[fd];
+    it.gen++;
+    it.ptr = ptr;
+    it.events = events;
+    it.armed = false;
+    it.listen = false;
+    Arm_(fd);
+    SubmitIfForeign_();
+    return true;
+}
+
+// 监听fd：支持buffer ring的内核(multishot accept是5.19加的，同一版本)用multishot accept
+bool UringPoller::AddListenFd(int fd, uint32_t events) {
+    if(!bufRing_) { return AddFd(fd, events, nullptr); }
+    if(fd < 0) return false;
+    std::lock_guard<std::mutex> locker(mtx_);
+    if(static_cast<size_t>(fd) >= interests_.size()) {
+        interests_.resize(fd + 1);
+    }
+    Interest& it = interests_[fd];
+    it.gen++;
+    it.ptr = nullptr;
+    it.events = events;
+    it.armed = false;
+    it.listen = true;
+    Arm_(fd);
+    SubmitIfForeign_();
+    return true;
+}
+
+// 修改：还在等待的注册先取消，再按新事件重新注册
+bool UringPoller::ModFd(int fd, uint32_t events, void* ptr) {
+    if(fd < 0) return false;
+    std::lock_guard<std::mutex> locker(mtx_);
+    if(static_cast<size_t>(fd) >= interests_.size() || interests_[fd].events == 0) {
+        return false;
+    }
+    Interest& it = interests_[fd];
+    if(it.armed) { Cancel_(fd); }
+    it.gen++;
+    it.ptr = ptr;
+    it.events = events;
+    Arm_(fd);
+    SubmitIfForeign_();
+    return true;
+}
+
+// 删除
+bool UringPoller::DelFd(int fd) {
+    if(fd < 0) return false;
+    std::lock_guard<std::mutex> locker(mtx_);
+    if(static_cast<size_t>(fd) >= interests_.size() || interests_[fd].events == 0) {
+        return false;
+    }
+    Interest& it = interests_[fd];
+    if(it.armed) { Cancel_(fd); }
+    it.gen++;
+    it.events = 0;
+    it.armed = false;
+    SubmitIfForeign_();
+    return true;
+}
+
+// 提交积累的注册请求并等待完成事件，一次系统调用完成两件事
+int UringPoller::Wait(int timeoutMs) {
+    unsigned toSubmit;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        loopId_ = std::this_thread::get_id();
+        /* 上一轮交出去的数据调用者已经处理完了 */
+        RecycleBufs_();
+        toSubmit = FlushSq_();
+    }
+    /* 完成队列里已经有事件，并且没有要提交的，就不进内核 */
+    bool cqEmpty = (*cqHead_ == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE));
+    if(toSubmit > 0 || cqEmpty) {
+        int ret = Enter_(toSubmit, cqEmpty ? 1 : 0, cqEmpty ? timeoutMs : 0);
+        if(ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            return -1;
+        }
+    }
+
+    std::lock_guard<std::mutex> locker(mtx_);
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+    while(head != tail && n < events_.size()) {
+        const io_uring_cqe* cqe = &cqes_[head & *cqMask_];
+        head++;
+        if(cqe->user_data == REMOVE_TAG) { continue; }
+        int fd = static_cast<int>(cqe->user_data & ~ACCEPT_BIT & 0xffffffff);
+        uint32_t gen = static_cast<uint32_t>(cqe->user_data >> 32);
+        /* recv用掉的缓冲区，下一次Wait还回去 */
+        const char* data = nullptr;
+        if(cqe->flags & IORING_CQE_F_BUFFER) {
+            uint16_t bid = static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            used_.push_back(bid);
+            data = bufs_ + static_cast<size_t>(bid) * BUF_SIZE;
+        }
+        bool stale = static_cast<size_t>(fd) >= interests_.size()
+                     || interests_[fd].gen != gen || interests_[fd].events == 0;
+        /* 已经被删除或修改过的注册；取消前刚accept到的连接没人要了 */
+        if(stale) {
+            if((cqe->user_data & ACCEPT_BIT) && cqe->res >= 0) { close(cqe->res); }
+            continue;
+        }
+        Interest& it = interests_[fd];
+        /* multishot accept带着IORING_CQE_F_MORE时还挂在内核里 */
+        bool more = (it.kind == ACCEPT) && (cqe->flags & IORING_CQE_F_MORE);
+        it.armed = more;
+        if(cqe->res == -ECANCELED) { continue; }
+        Event& ev = events_[n];
+        ev.ptr = it.ptr;
+        ev.acceptedFd = -1;
+        ev.data = nullptr;
+        ev.len = 0;
+        if(it.kind == POLL) {
+            ev.events = cqe->res < 0 ? EPOLLERR : static_cast<uint32_t>(cqe->res);
+        } else if(it.kind == ACCEPT) {
+            /* accept失败(比如fd用完了)不报事件，等下一个连接 */
+            if(cqe->res < 0) {
+                if(!more) { Arm_(fd); }
+                continue;
+            }
+            ev.events = EPOLLIN;
+            ev.acceptedFd = cqe->res;
+        } else if(cqe->res > 0) {
+            ev.events = EPOLLIN;
+            ev.data = data;
+            ev.len = static_cast<size_t>(cqe->res);
+        } else if(cqe->res == 0) {
+            ev.events = EPOLLIN | EPOLLRDHUP;   // 对端关闭
+        } else if(cqe->res == -ENOBUFS) {
+            ev.events = EPOLLIN;                // 缓冲区用完了，数据还在socket里，调用者自己读
+        } else {
+            ev.events = EPOLLERR;
+        }
+        n++;
+        /* 没有EPOLLONESHOT的fd(监听fd)自动重新注册，跟着下一次Wait提交 */
+        if(!more && !(it.events & EPOLLONESHOT)) { Arm_(fd); }
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    return static_cast<int>(n);
+}
+
+void* UringPoller::GetEventPtr(size_t i) const {
+    assert(i < events_.size() && i >= 0);
+    return events_[i].ptr;
+}
+
+uint32_t UringPoller::GetEvents(size_t i) const {
+    assert(i < events_.size() && i >= 0);
+    return events_[i].events;
+}
+
+int UringPoller::GetAcceptedFd(size_t i) const {
+    assert(i < events_.size() && i >= 0);
+    return events_[i].acceptedFd;
+}
+
+size_t UringPoller::GetData(size_t i, const char** data) const {
+    assert(i < events_.size() && i >= 0);
+    *data = events_[i].data;
+    return events_[i].len;
+}
+
+// 取一个空闲的sqe，提交队列满了就先提交
+io_uring_sqe* UringPoller::GetSqe_() {
+    if(sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+        Enter_(FlushSq_(), 0, 0);
+    }
+    unsigned idx = sqLocalTail_ & *sqMask_;
+    sqArray_[idx] = idx;
+    sqLocalTail_++;
+    io_uring_sqe* sqe = &sqes_[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// 注册一次，user_data = gen << 32 | fd，accept再带上ACCEPT_BIT
+// 监听fd挂multishot accept；只等读的连接挂从buffer ring取缓冲区的recv；其他的挂一次性的poll
+void UringPoller::Arm_(int fd) {
+    Interest& it = interests_[fd];
+    io_uring_sqe* sqe = GetSqe_();
+    sqe->fd = fd;
+    if(bufRing_ && it.listen) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        it.kind = ACCEPT;
+    } else if(bufRing_ && (it.events & EPOLLIN) && !(it.events & EPOLLOUT)) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUF_GROUP;
+        sqe->len = BUF_SIZE;
+        it.kind = RECV;
+    } else {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        /* POLLIN/POLLOUT/POLLRDHUP... 与 EPOLL* 的取值相同 */
+        sqe->poll32_events = it.events & ~(EPOLLONESHOT | EPOLLET);
+        it.kind = POLL;
+    }
+    sqe->user_data = UserData_(fd);
+    it.armed = true;
+}
+
+// 取消还挂着的请求；调用者要修改或删除注册，已经收到的数据不要了
+void UringPoller::Cancel_(int fd) {
+    Interest& it = interests_[fd];
+    io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = it.kind == POLL ? IORING_OP_POLL_REMOVE : IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = UserData_(fd);
+    sqe->user_data = REMOVE_TAG;
+    it.armed = false;
+}
+
+uint64_t UringPoller::UserData_(int fd) const {
+    const Interest& it = interests_[fd];
+    uint64_t data = (static_cast<uint64_t>(it.gen) << 32) | static_cast<uint32_t>(fd);
+    return it.kind == ACCEPT ? data | ACCEPT_BIT : data;
+}
+
+// 把用过的缓冲区放回环尾
+void UringPoller::RecycleBufs_() {
+    if(!bufRing_ || used_.empty()) { return; }
+    for(uint16_t bid : used_) {
+        /* C++里头文件的bufs(柔性数组前面有个空结构体)不在偏移0，直接按io_uring_buf数组访问；
+           环尾和第0个的resv共用，只写这三个字段 */
+        io_uring_buf& buf = reinterpret_cast<io_uring_buf*>(bufRing_)[bufTail_ & (BUF_COUNT - 1)];
+        buf.addr = reinterpret_cast<uint64_t>(bufs_ + static_cast<size_t>(bid) * BUF_SIZE);
+        buf.len = BUF_SIZE;
+        buf.bid = bid;
+        bufTail_++;
+    }
+    used_.clear();
+    __atomic_store_n(&bufRing_->tail, bufTail_, __ATOMIC_RELEASE);
+}
+
+// 不是事件循环线程发起的注册要立即提交，否则事件循环可能一直阻塞在Wait里
+void UringPoller::SubmitIfForeign_() {
+    if(std::this_thread::get_id() != loopId_) {
+        Enter_(FlushSq_(), 0, 0);
+    }
+}
+
+// 让内核看到新的提交队列尾，返回待提交的数量
+unsigned UringPoller::FlushSq_() {
+    __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+    return sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+}
+
+int UringPoller::Enter_(unsigned toSubmit, unsigned minComplete, int timeoutMs) {
+    unsigned flags = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    memset(&arg, 0, sizeof(arg));
+    if(minComplete > 0) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        if(timeoutMs >= 0) {
+            ts.tv_sec = timeoutMs / 1000;
+            ts.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+        }
+    }
+    if(toSubmit == 0 && minComplete == 0) { return 0; }
+    return syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete, flags,
+                   flags ? &arg : nullptr, flags ? sizeof(arg) : 0);
+}
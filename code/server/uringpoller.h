@@ -0,0 +1,129 @@
+#ifndef URING_POLLER_H
+#define URING_POLLER_H
+
+#include <linux/io_uring.h>
+#include <sys/epoll.h>   // EPOLLIN, EPOLLONESHOT...
+#include <sys/mman.h>    // mmap()
+#include <sys/syscall.h> // io_uring_setup(), io_uring_enter()
+#include <unistd.h>      // close()
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "poller.h"
+
+// 基于io_uring的事件后端，直接使用系统调用，不依赖liburing
+// 注册保持和EPOLLONESHOT一样的语义：完成一次后要ModFd重新注册。
+// 事件循环线程里的注册请求只放进提交队列，和下一次Wait合并成一次io_uring_enter，
+// 省掉每个请求一次的epoll_ctl(MOD)；其他线程(线程池)里的注册请求立即提交
+// 内核支持provided buffer ring(5.19+)时：
+//   监听fd用multishot accept，一次注册一直交出新连接，不用再调accept
+//   等EPOLLIN的连接注册成从buffer ring取缓冲区的recv，完成事件里直接带着数据，不用再调read；
+//   缓冲区用完(-ENOBUFS)时退回只报EPOLLIN，由调用者自己read
+// 不支持时退回IORING_OP_POLL_ADD，只报就绪
+class UringPoller : public Poller {
+public:
+    explicit UringPoller(int maxEvent = 1024);
+
+    ~UringPoller() override;
+
+    bool IsValid() const { return ringFd_ >= 0; }   // 内核不支持io_uring时为false
+
+    bool AddFd(int fd, uint32_t events, void* ptr) override;
+
+    bool ModFd(int fd, uint32_t events, void* ptr) override;
+
+    bool DelFd(int fd) override;
+
+    int Wait(int timeoutMs = -1) override;
+
+    void* GetEventPtr(size_t i) const override;
+
+    uint32_t GetEvents(size_t i) const override;
+
+    bool AddListenFd(int fd, uint32_t events) override;
+
+    int GetAcceptedFd(size_t i) const override;
+
+    size_t GetData(size_t i, const char** data) const override;
+
+    bool HasBufRing() const { return bufRing_ != nullptr; }
+
+private:
+    enum Kind { POLL, ACCEPT, RECV };
+
+    // 每个fd的注册信息，gen用来丢弃已经删除/修改过的注册产生的过期完成事件
+    struct Interest {
+        void* ptr = nullptr;
+        uint32_t events = 0;
+        uint32_t gen = 0;
+        bool armed = false;
+        bool listen = false;
+        Kind kind = POLL;   // 现在挂着的是哪种请求
+    };
+
+    struct Event {
+        void* ptr;
+        uint32_t events;
+        int acceptedFd;     // multishot accept交出的连接，没有为-1
+        const char* data;   // recv收到的数据(buffer ring里的缓冲区)
+        size_t len;
+    };
+
+    bool InitRing_(unsigned entries);
+    void FreeRing_();
+    bool InitBufRing_();
+    void FreeBufRing_();
+
+    // 以下需持有mtx_
+    io_uring_sqe* GetSqe_();
+    void Arm_(int fd);
+    void Cancel_(int fd);
+    void SubmitIfForeign_();
+    unsigned FlushSq_();
+    void RecycleBufs_();    // 上一轮交出去的缓冲区还给buffer ring
+    uint64_t UserData_(int fd) const;
+
+    int Enter_(unsigned toSubmit, unsigned minComplete, int timeoutMs);
+
+    static const uint64_t REMOVE_TAG = ~0ULL;   // POLL_REMOVE/ASYNC_CANCEL自身的完成事件
+    static const uint64_t ACCEPT_BIT = 1ULL << 31;  // fd不会用到最高位，过期的accept靠它认出来
+    static const unsigned BUF_COUNT = 256;      // buffer ring里的缓冲区数，必须是2的幂
+    static const unsigned BUF_SIZE = 8192;      // 每个缓冲区的大小，一次recv最多收这么多
+    static const uint16_t BUF_GROUP = 0;
+
+    int ringFd_;
+    unsigned sqEntries_;
+
+    void* sqRing_;
+    size_t sqRingSize_;
+    void* cqRing_;
+    size_t cqRingSize_;
+    io_uring_sqe* sqes_;
+    size_t sqesSize_;
+
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned* sqMask_;
+    unsigned* sqArray_;
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned* cqMask_;
+    io_uring_cqe* cqes_;
+
+    unsigned sqLocalTail_;  // 已填写但还没对内核可见的提交队列尾
+
+    std::thread::id loopId_;    // 调用Wait的事件循环线程
+    std::mutex mtx_;            // 保护提交队列和interests_
+    std::vector<Interest> interests_;   // 以fd为下标
+    std::vector<Event> events_;         // 检测到的事件的集合
+
+    io_uring_buf_ring* bufRing_;    // 注册给内核的缓冲区环，nullptr表示不支持
+    char* bufs_;                    // BUF_COUNT个缓冲区
+    uint16_t bufTail_;
+    std::vector<uint16_t> used_;    // 交出去还没还回去的缓冲区
+};
+
+#endif //URING_POLLER_H
@@ -6,9 +6,10 @@ WebServer::WebServer(
             int port, int trigMode, int timeoutMS, bool OptLinger,
             int sqlPort, const char* sqlUser, const  char* sqlPwd, const char* dbName, 
             int connPoolNum, int threadNum,
-            bool openLog, int logLevel, int logQueSize):
+            bool openLog, int logLevel, int logQueSize, bool multiReactor, int ioBackend, bool inlineIO, bool sendFile,
+            bool precompress, int gzipLevel, bool watchFiles):
             port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false), isLogOpen_(openLog),
-            timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller())
+            multiReactor_(multiReactor), ioBackend_(ioBackend), inlineIO_(inlineIO), sendFile_(sendFile)
 {
     //C库函数 /home/guochuanyu/WebServer-withnote/
     srcDir_ = getcwd(nullptr, 256); // 获取当前的工作路径
@@ -19,6 +20,8 @@ WebServer::WebServer(
     // 将HttpConn中的静态变量，初始化当前所有连接数
     HttpConn::userCount = 0;
     HttpConn::srcDir = srcDir_;
+    FileCache::Instance()->SetMapFiles(!sendFile_);
+    CompressCache::Instance()->SetLevel(gzipLevel);
 
     // 初始化数据库连接池(暂时不懂)
     SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
@@ -26,8 +29,27 @@ WebServer::WebServer(
     // 初始化事件的模式
     InitEventMode_(trigMode);
     
-    // 初始化网络通信,socket，bind，listen，epoll_create，epoll_ctl
-    if(!InitSocket_()) { isClose_ = true;}
+    // 连接表的大小：fd不会超过进程能打开的文件数
+    size_t maxFd = MAX_FD;
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < maxFd) {
+        maxFd = rl.rlim_cur;
+    }
+    users_.resize(maxFd);
+
+    // 单reactor模式：一个事件循环 + 线程池处理读写
+    // 多reactor模式：threadNum个事件循环，各自监听同一端口(SO_REUSEPORT)，读写在本线程完成
+    int reactorNum = multiReactor_ ? threadNum : 1;
+    if(!multiReactor_) { threadpool_.reset(new ThreadPool(threadNum)); }
+    for(int i = 0; i < reactorNum; i++) {
+        std::unique_ptr<Reactor> r(new Reactor);
+        r->timer.reset(new TimerWheel());
+        r->poller.reset(NewPoller_());
+        r->batch.reserve(1024);
+        // 初始化网络通信,socket，bind，listen，epoll_create，epoll_ctl
+        if(!InitSocket_(r.get())) { isClose_ = true; }
+        reactors_.push_back(std::move(r));
+    }
 
     //如果开启日志系统，就进行下面的操作
     if(openLog) {
@@ -43,13 +65,37 @@ WebServer::WebServer(
             LOG_INFO("LogSys level: %d", logLevel);
             LOG_INFO("srcDir: %s", HttpConn::srcDir);
             LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            LOG_INFO("Conn table size: %d", (int)users_.size());
+            LOG_INFO("Reactor Mode: %s, Reactor num: %d", multiReactor_ ? "multi" : "single", reactorNum);
+            LOG_INFO("IO Backend: %s, Inline IO: %s", ioBackend_ == 1 ? "io_uring" : "epoll",
+                            inlineIO_ ? "true" : "false");
+            LOG_INFO("File Body: %s, Precompress: %s, Gzip level: %d", sendFile_ ? "sendfile" : "mmap",
+                            precompress ? "true" : "false", gzipLevel);
         }
     }
+
+    // 先开始监视，后台生成的.gz/.br写好后会通知缓存重新加载
+    if(watchFiles && !isClose_) {
+        bool watching = watcher_.Start(srcDir_);
+        LOG_INFO("File watcher: %s", watching ? "inotify" : "unavailable, revalidate by stat");
+    }
+
+    if(precompress && !isClose_) {
+        std::string dir = srcDir_;
+        precompressThread_ = std::thread([dir] {
+            int count = Precompressor::Run(dir);
+            LOG_INFO("Precompressed %d files", count);
+        });
+    }
 }
 
 WebServer::~WebServer() {
-    close(listenFd_);
+    for(auto& r: reactors_) {
+        if(r->listenFd >= 0) { close(r->listenFd); }
+    }
     isClose_ = true;
+    if(precompressThread_.joinable()) { precompressThread_.join(); }
+    watcher_.Stop();
     free(srcDir_);
     SqlConnPool::Instance()->ClosePool();
 }
@@ -80,57 +126,94 @@ void WebServer::InitEventMode_(int trigMode) {
     HttpConn::isET = (connEvent_ & EPOLLET);
 }
 
+// 创建IO事件后端，io_uring不可用时退回epoll
+Poller* WebServer::NewPoller_() {
+    if(ioBackend_ == 1) {
+        UringPoller* uring = new UringPoller();
+        if(uring->IsValid()) {
+            return uring;
+        }
+        delete uring;
+        ioBackend_ = 0;
+    }
+    return new Epoller();
+}
+
 // 启动服务器
 void WebServer::Start() {
-    int timeMS = -1;  /* epoll wait timeout == -1 无事件将阻塞 */
     //isClose默认初始化为false，意思就是服务器开起来，没关
     if(!isClose_) { LOG_INFO("========== Server start =========="); }
-     
+
+    // 多reactor模式下，第一个事件循环在当前线程运行，其余每个一个线程
+    std::vector<std::thread> loops;
+    for(size_t i = 1; i < reactors_.size(); i++) {
+        loops.emplace_back(&WebServer::Loop_, this, reactors_[i].get());
+    }
+    Loop_(reactors_[0].get());
+    for(auto& t: loops) {
+        t.join();
+    }
+}
+
+// 事件循环
+void WebServer::Loop_(Reactor* r) {
+    int timeMS = -1;  /* epoll wait timeout == -1 无事件将阻塞 */
+    r->tid = std::this_thread::get_id();
     while(!isClose_) {
 
         // 如果设置了超时时间，例如60s,则只要一个连接60秒没有读写操作就关闭
         if(timeoutMS_ > 0) {
             // 通过定时器GetNextTick(),清除超时的节点，然后获取最先要超时的连接的超时的时间
-            timeMS = timer_->GetNextTick();
+            timeMS = r->timer->GetNextTick();
         }
 
         // timeMS是最先要超时的连接的超时的时间，传递到epoll_wait()函数中
         // 当timeMS时间内有事件发生，epoll_wait()返回，否则等到了timeMS时间后才返回
         // 这样做的目的是为了让epoll_wait()调用次数变少，提高效率
         //epoll_wait()返回活跃的事件数
-        int eventCnt = epoller_->Wait(timeMS);
+        int eventCnt = r->poller->Wait(timeMS);
 
         // 循环处理每一个事件
         for(int i = 0; i < eventCnt; i++) {
             /* 处理事件 */
-            int fd = epoller_->GetEventFd(i);   // 获取事件对应的fd
-            uint32_t events = epoller_->GetEvents(i);   // 获取事件的类型
+            // 注册时放进去的连接指针，监听fd注册的是nullptr
+            HttpConn* client = static_cast<HttpConn*>(r->poller->GetEventPtr(i));
+            uint32_t events = r->poller->GetEvents(i);   // 获取事件的类型
             
             // 监听的文件描述符有事件，说明有新的连接进来
-            if(fd == listenFd_) {
-                DealListen_();  // 处理监听的操作，接受客户端连接，就是accept()的封装
+            if(!client) {
+                int fd = r->poller->GetAcceptedFd(i);   // io_uring已经accept好了
+                if(fd >= 0) { DealAccepted_(r, fd); }
+                else { DealListen_(r); }  // 处理监听的操作，接受客户端连接，就是accept()的封装
             }
             
             // 错误的一些情况
             else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                assert(users_.count(fd) > 0);
-                CloseConn_(&users_[fd]);    // 关闭连接
+                CloseConn_(r, client);    // 关闭连接
             }
 
             // 有数据到达
             else if(events & EPOLLIN) {
-                assert(users_.count(fd) > 0); //确保这个用户在线
-                DealRead_(&users_[fd]); // 处理读操作
+                // io_uring的recv已经把数据带过来了，先放进读缓冲区
+                const char* data;
+                size_t len = r->poller->GetData(i, &data);
+                if(len) { client->Feed(data, len); }
+                DealRead_(r, client); // 处理读操作
             }
             
             // 可以发送数据
             else if(events & EPOLLOUT) {
-                assert(users_.count(fd) > 0);
-                DealWrite_(&users_[fd]);    // 处理写操作
+                DealWrite_(r, client);    // 处理写操作
             } else {
                 LOG_ERROR("Unexpected event");
             }
         }
+
+        // 一次性把这一轮的读写任务交给线程池
+        if(!r->batch.empty()) {
+            threadpool_->AddTasks(r->batch.begin(), r->batch.end());
+            r->batch.clear();
+        }
     }
 }
 
@@ -145,10 +228,14 @@ void WebServer::SendError_(int fd, const char*info) {
 }
 
 // 关闭连接（从epoll中删除，解除响应对象中的内存映射，用户数递减，关闭文件描述符）
-void WebServer::CloseConn_(HttpConn* client) {
+void WebServer::CloseConn_(Reactor* r, HttpConn* client) {
     assert(client);
     LOG_INFO("Client[%d] quit!", client->GetFd());
-    epoller_->DelFd(client->GetFd());
+    // 关fd之前把定时器节点删掉：多reactor模式下这个fd号可能马上被别的reactor的新连接用上，
+    // 留着的旧节点到期会在这个reactor的线程里关掉那个新连接。
+    // 线程池里关闭的(单reactor模式)不能碰定时器，旧节点到期时连接已经关了，或者同号fd的新连接add时已经覆盖了它
+    if(std::this_thread::get_id() == r->tid) { r->timer->del(client->GetFd()); }
+    r->poller->DelFd(client->GetFd());
     client->Close();
 }
 
@@ -159,19 +246,28 @@ void WebServer::CloseConn_(HttpConn* client) {
  4.将该客户端的fd设置为非阻塞
  5.日志输出LOG_INFO
  */
-void WebServer::AddClient_(int fd, sockaddr_in addr) {
+void WebServer::AddClient_(Reactor* r, int fd, sockaddr_in addr) {
     assert(fd > 0);
-    users_[fd].init(fd, addr); //客户端连接信息表中添加这个客户信息
+    assert(static_cast<size_t>(fd) < users_.size());
+    // 这个fd号第一次使用时创建连接对象，之后一直复用
+    if(!users_[fd]) { users_[fd].reset(new HttpConn()); }
+    HttpConn* client = users_[fd].get();
+    client->init(fd, addr); //客户端连接信息表中添加这个客户信息
     //如果有超时时间限制，就添加到定时器对象中
     if(timeoutMS_ > 0) {
         // 添加到定时器对象中，当检测到超时时执行CloseConn_函数进行关闭连接
-        timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd])); //
+        r->timer->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, r, client)); //
     }
     // 添加到epoll树中进行管理，是epoll_ctl()的封装
-    epoller_->AddFd(fd, EPOLLIN | connEvent_);
+    r->poller->AddFd(fd, EPOLLIN | connEvent_, client);
     // 设置文件描述符非阻塞
     SetFdNonblock(fd);
-    LOG_INFO("Client[%d] in!", users_[fd].GetFd());
+    if(sendFile_) {
+        // 响应头靠MSG_MORE和文件内容凑包，文件末尾不足一个MSS的包不用等Nagle
+        int optval = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    }
+    LOG_INFO("Client[%d] in!", client->GetFd());
 }
 
 /*
@@ -180,76 +276,132 @@ void WebServer::AddClient_(int fd, sockaddr_in addr) {
      1.1 AddClient_()，将connectfd和addr加入到Epoller的树上和HttpConn对象中
  }
 */
-void WebServer::DealListen_() {
+void WebServer::DealListen_(Reactor* r) {
     struct sockaddr_in addr; // 保存新连接进来的客户端的信息，需要1个fd和一个addr(IP，Port)
     socklen_t len = sizeof(addr);
     // 处理这个监听描述符中的连接
     // 如果监听文件描述符设置的是 ET模式，则需要循环把所有连接处理了
     do {
-        int fd = accept(listenFd_, (struct sockaddr *)&addr, &len); //阻塞监听等待新用户
+        int fd = accept(r->listenFd, (struct sockaddr *)&addr, &len); //阻塞监听等待新用户
         if(fd <= 0) { return;}  //出错直接结束函数
-        else if(HttpConn::userCount >= MAX_FD) {  //又或者客户端连接数到达最大，就也是记录日志
-            SendError_(fd, "Server busy!");
-            LOG_WARN("Clients is full!");
-            return;
-        }
-        AddClient_(fd, addr);   // 添加客户端，也就是将该描述符和客户端的信息添加到
+        if(!TryAddClient_(r, fd, addr)) { return; }
     } while(listenEvent_ & EPOLLET);
 }
 
+// 事件后端已经accept好的连接，没有地址，打开日志时才去查
+void WebServer::DealAccepted_(Reactor* r, int fd) {
+    struct sockaddr_in addr = { 0 };
+    if(isLogOpen_) {
+        socklen_t len = sizeof(addr);
+        getpeername(fd, (struct sockaddr *)&addr, &len);
+    }
+    TryAddClient_(r, fd, addr);
+}
+
+// 客户端连接数到达最大就回绝，返回false
+bool WebServer::TryAddClient_(Reactor* r, int fd, sockaddr_in addr) {
+    if(HttpConn::userCount >= MAX_FD || static_cast<size_t>(fd) >= users_.size()) {  //又或者客户端连接数到达最大，就也是记录日志
+        SendError_(fd, "Server busy!");
+        LOG_WARN("Clients is full!");
+        return false;
+    }
+    AddClient_(r, fd, addr);   // 添加客户端，也就是将该描述符和客户端的信息添加到
+    return true;
+}
+
 /*DealRead_(),读事件处理
  1.延长这个客户端fd的超时时间
  2.线程池中添加任务
  */
-void WebServer::DealRead_(HttpConn* client) {
+void WebServer::DealRead_(Reactor* r, HttpConn* client) {
     assert(client);
-    ExtentTime_(client);   // 延长这个客户端的超时时间
-    // 将该读任务加入到队列中等待线程池中的线程处理（读取数据）
-    threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));
+    ExtentTime_(r, client);   // 延长这个客户端的超时时间
+    // 多reactor模式直接在本线程读取
+    if(multiReactor_) {
+        OnRead_(r, client);
+        return;
+    }
+    if(inlineIO_) {
+        OnReadInline_(r, client);
+        return;
+    }
+    // 将该读任务放进本轮的批次，事件处理完后一起交给线程池（读取数据）
+    r->batch.emplace_back(IoTask{this, r, client, IoTask::READ});
 }
 
 // 处理写
-void WebServer::DealWrite_(HttpConn* client) {
+void WebServer::DealWrite_(Reactor* r, HttpConn* client) {
     assert(client);
-    ExtentTime_(client);// 延长这个客户端的超时时间
-    // 加入到队列中等待线程池中的线程处理（写数据）
-    threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
+    ExtentTime_(r, client);// 延长这个客户端的超时时间
+    if(multiReactor_) {
+        OnWrite_(r, client);
+        return;
+    }
+    // 放进本轮的批次，事件处理完后一起交给线程池（写数据）
+    r->batch.emplace_back(IoTask{this, r, client, IoTask::WRITE});
 }
 
 // 延长客户端的超时时间
-void WebServer::ExtentTime_(HttpConn* client) {
+void WebServer::ExtentTime_(Reactor* r, HttpConn* client) {
     assert(client);
-    if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), timeoutMS_); }
+    if(timeoutMS_ > 0) { r->timer->adjust(client->GetFd(), timeoutMS_); }
 }
 
-// 这个方法是在子线程中执行的（读取数据）
-void WebServer::OnRead_(HttpConn* client) {
+// 这个方法是在子线程中执行的（读取数据），多reactor模式下在事件循环线程执行
+void WebServer::OnRead_(Reactor* r, HttpConn* client) {
     assert(client);
     int ret = -1;
     int readErrno = 0;
     ret = client->read(&readErrno); // 读取客户端的数据
     if(ret <= 0 && readErrno != EAGAIN) {
-        CloseConn_(client);
+        CloseConn_(r, client);
         return;
     }
 
     // 业务逻辑的处理
-    OnProcess(client);
+    OnProcess(r, client);
+}
+
+// 在事件循环线程直接完成 读->解析->写，省掉两次线程切换和一次ModFd(EPOLLOUT)
+// 要查数据库的请求交给线程池处理，一次没写完的等EPOLLOUT后由线程池继续写
+void WebServer::OnReadInline_(Reactor* r, HttpConn* client) {
+    assert(client);
+    int readErrno = 0;
+    ssize_t ret = client->read(&readErrno);
+    if(ret <= 0 && readErrno != EAGAIN) {
+        CloseConn_(r, client);
+        return;
+    }
+    if(!client->process(false, true)) {
+        if(client->IsBlockingRequest()) {
+            r->batch.emplace_back(IoTask{this, r, client, IoTask::PROCESS});
+        } else {
+            r->poller->ModFd(client->GetFd(), connEvent_ | EPOLLIN, client);
+        }
+        return;
+    }
+    OnWrite_(r, client);
 }
 
 // 业务逻辑的处理
-void WebServer::OnProcess(HttpConn* client) {
-    if(client->process()) {
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+// 单reactor模式下在事件循环线程里(小请求直接处理，写完接着处理流水线后面的请求)遇到要查数据库的请求，
+// 停在它前面交给线程池；多reactor模式没有线程池，都在本线程处理
+void WebServer::OnProcess(Reactor* r, HttpConn* client) {
+    bool loopThread = std::this_thread::get_id() == r->tid;   // 在这里不能等现场压缩
+    bool onLoop = threadpool_ && loopThread;                  // 要查数据库的交给线程池
+    if(client->process(!onLoop, loopThread)) {
+        r->poller->ModFd(client->GetFd(), connEvent_ | EPOLLOUT, client);
+    } else if(onLoop && client->IsBlockingRequest()) {
+        r->batch.emplace_back(IoTask{this, r, client, IoTask::PROCESS});
     } else {
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+        r->poller->ModFd(client->GetFd(), connEvent_ | EPOLLIN, client);
     }
 }
 
 // 写数据
-void WebServer::OnWrite_(HttpConn* client) {
+void WebServer::OnWrite_(Reactor* r, HttpConn* client) {
     assert(client);
-    int ret = -1;
+    ssize_t ret = -1;
     int writeErrno = 0;
     ret = client->write(&writeErrno);   // 写数据
 
@@ -257,22 +409,22 @@ void WebServer::OnWrite_(HttpConn* client) {
     if(client->ToWriteBytes() == 0) {
         /* 传输完成 */
         if(client->IsKeepAlive()) {
-            OnProcess(client);
+            OnProcess(r, client);
             return;
         }
     }
     else if(ret < 0) {
         if(writeErrno == EAGAIN) {
-            /* 继续传输 */
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+            /* 继续传输：socket写满了或者这次的预算用完了，重新注册后排到就绪队列后面 */
+            r->poller->ModFd(client->GetFd(), connEvent_ | EPOLLOUT, client);
             return;
         }
     }
-    CloseConn_(client);
+    CloseConn_(r, client);
 }
 
 /* Create listenFd */
-bool WebServer::InitSocket_() {
+bool WebServer::InitSocket_(Reactor* r) {
     int ret;
     struct sockaddr_in addr;
     if(port_ > 65535 || port_ < 1024) {
@@ -290,15 +442,15 @@ bool WebServer::InitSocket_() {
         optLinger.l_linger = 1;
     }
 
-    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if(listenFd_ < 0) {
+    r->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if(r->listenFd < 0) {
         LOG_ERROR("Create socket error!", port_);
         return false;
     }
 
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+    ret = setsockopt(r->listenFd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
     if(ret < 0) {
-        close(listenFd_);
+        close(r->listenFd);
         LOG_ERROR("Init linger error!", port_);
         return false;
     }
@@ -306,34 +458,44 @@ bool WebServer::InitSocket_() {
     int optval = 1;
     /* 端口复用 */
     /* 只有最后一个套接字会正常接收数据。 */
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
+    ret = setsockopt(r->listenFd, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
     if(ret == -1) {
         LOG_ERROR("set socket setsockopt error !");
-        close(listenFd_);
+        close(r->listenFd);
         return false;
     }
 
-    ret = bind(listenFd_, (struct sockaddr *)&addr, sizeof(addr));
+    /* 多reactor模式：每个事件循环各自bind同一端口，由内核按连接分发到各监听socket */
+    if(multiReactor_) {
+        ret = setsockopt(r->listenFd, SOL_SOCKET, SO_REUSEPORT, (const void*)&optval, sizeof(int));
+        if(ret == -1) {
+            LOG_ERROR("set socket SO_REUSEPORT error !");
+            close(r->listenFd);
+            return false;
+        }
+    }
+
+    ret = bind(r->listenFd, (struct sockaddr *)&addr, sizeof(addr));
     if(ret < 0) {
         LOG_ERROR("Bind Port:%d error!", port_);
-        close(listenFd_);
+        close(r->listenFd);
         return false;
     }
 
-    ret = listen(listenFd_, 6);
+    ret = listen(r->listenFd, 6);
     if(ret < 0) {
         LOG_ERROR("Listen port:%d error!", port_);
-        close(listenFd_);
+        close(r->listenFd);
         return false;
     }
 
-    ret = epoller_->AddFd(listenFd_,  listenEvent_ | EPOLLIN);
+    ret = r->poller->AddListenFd(r->listenFd,  listenEvent_ | EPOLLIN);
     if(ret == 0) {
         LOG_ERROR("Add listen error!");
-        close(listenFd_);
+        close(r->listenFd);
         return false;
     }
-    SetFdNonblock(listenFd_);
+    SetFdNonblock(r->listenFd);
     LOG_INFO("Server port:%d", port_);
     return true;
 }
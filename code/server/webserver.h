@@ -1,22 +1,29 @@
 #ifndef WEBSERVER_H
 #define WEBSERVER_H
 
-#include <unordered_map>
+#include <vector>
+#include <thread>
 #include <fcntl.h>       // fcntl()
 #include <unistd.h>      // close()
 #include <assert.h>
 #include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY
 #include <arpa/inet.h>
+#include <sys/resource.h> // getrlimit()
 
 #include "epoller.h"
+#include "uringpoller.h"
 #include "../log/log.h"
-#include "../timer/heaptimer.h"
+#include "../timer/timerwheel.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
 #include "../pool/sqlconnRAII.h"
 #include "../http/httpconn.h"
+#include "../http/precompress.h"
+#include "../http/compresscache.h"
+#include "../http/filewatcher.h"
 
 class WebServer {
 public:
@@ -24,27 +31,60 @@ public:
         int port, int trigMode, int timeoutMS, bool OptLinger, 
         int sqlPort, const char* sqlUser, const  char* sqlPwd, 
         const char* dbName, int connPoolNum, int threadNum,
-        bool openLog, int logLevel, int logQueSize);
+        bool openLog, int logLevel, int logQueSize,
+        bool multiReactor = false, int ioBackend = 0, bool inlineIO = false, bool sendFile = false,
+        bool precompress = false, int gzipLevel = 0, bool watchFiles = false);
 
     ~WebServer();
     void Start();   //1.运行
 
 private:
-    bool InitSocket_();   //socket(),bind(),listen(),
+    // 一个事件循环：拥有自己的监听socket、IO事件后端和定时器
+    // 多reactor模式下每个线程一个，连接从accept到读写都只在这一个线程上
+    struct Reactor {
+        int listenFd = -1;
+        std::unique_ptr<TimerWheel> timer;
+        std::unique_ptr<Poller> poller;
+        std::vector<Task> batch;    // 本轮epoll_wait产生的读写任务，处理完所有事件后一起交给线程池
+        std::thread::id tid;        // 运行这个事件循环的线程，定时器只能在这个线程里操作
+    };
+
+    // 交给线程池的读/写任务：连接 + 操作，平凡可复制，放在Task内部，派发时不分配内存
+    struct IoTask {
+        enum Op { READ, WRITE, PROCESS };
+        WebServer* server;
+        Reactor* r;
+        HttpConn* client;
+        Op op;
+        void operator()() const {
+            switch(op) {
+            case READ: server->OnRead_(r, client); break;
+            case WRITE: server->OnWrite_(r, client); break;
+            case PROCESS: server->OnProcess(r, client); break;
+            }
+        }
+    };
+
+    bool InitSocket_(Reactor* r);   //socket(),bind(),listen(),
     void InitEventMode_(int trigMode);
-    void AddClient_(int fd, sockaddr_in addr);
-  
-    void DealListen_();
-    void DealWrite_(HttpConn* client);
-    void DealRead_(HttpConn* client);
+    Poller* NewPoller_();   // 按ioBackend_创建IO事件后端
+    void AddClient_(Reactor* r, int fd, sockaddr_in addr);
+    bool TryAddClient_(Reactor* r, int fd, sockaddr_in addr);
+
+    void Loop_(Reactor* r);   // 事件循环
+    void DealListen_(Reactor* r);
+    void DealAccepted_(Reactor* r, int fd);
+    void DealWrite_(Reactor* r, HttpConn* client);
+    void DealRead_(Reactor* r, HttpConn* client);
 
     void SendError_(int fd, const char*info);
-    void ExtentTime_(HttpConn* client);
-    void CloseConn_(HttpConn* client);
+    void ExtentTime_(Reactor* r, HttpConn* client);
+    void CloseConn_(Reactor* r, HttpConn* client);
 
-    void OnRead_(HttpConn* client);
-    void OnWrite_(HttpConn* client);
-    void OnProcess(HttpConn* client);
+    void OnRead_(Reactor* r, HttpConn* client);
+    void OnReadInline_(Reactor* r, HttpConn* client);
+    void OnWrite_(Reactor* r, HttpConn* client);
+    void OnProcess(Reactor* r, HttpConn* client);
 
     static const int MAX_FD = 65536;    // 最大的文件描述符的个数
 
@@ -56,18 +96,24 @@ private:
     int timeoutMS_;  /* 毫秒MS 超时关闭时间*/
     bool isClose_;  // 服务器是否关闭判断
     bool isLogOpen_; //日志开关
-    int listenFd_;  // 监听的文件描述符
     char* srcDir_;  // 资源的目录
+    bool multiReactor_; // 是否每个线程一个事件循环(SO_REUSEPORT分片监听)
+    int ioBackend_;     // IO事件后端 0:epoll 1:io_uring(内核不支持时退回epoll)
+    bool inlineIO_;     // 单reactor模式下小请求直接在事件循环线程读、解析、写
+    bool sendFile_;     // 文件内容用sendfile从缓存的fd发，否则mmap后writev
+    std::thread precompressThread_; // 启动时在后台给静态资源生成.gz/.br
+    FileWatcher watcher_;   // 资源目录有变化时更新缓存，开着的时候缓存不再定期stat
     
     
     uint32_t listenEvent_;  // 监听的文件描述符的事件
     uint32_t connEvent_;    // 连接的文件描述符的事件
 
 //内部包含的实际工作的单元
-    std::unique_ptr<HeapTimer> timer_;         // 定时器类型的智能指针timer_
-    std::unique_ptr<ThreadPool> threadpool_;   // 线程池
-    std::unique_ptr<Epoller> epoller_;         // epoll对象
-    std::unordered_map<int, HttpConn> users_;  // 用hashmap保存客户端连接的信息表，key用fd表示，value用HttpConn表示
+    std::unique_ptr<ThreadPool> threadpool_;   // 线程池(多reactor模式下不使用)
+    std::vector<std::unique_ptr<Reactor>> reactors_;   // 事件循环，单reactor模式下只有一个
+    // 客户端连接表，以fd为下标，大小在构造时按MAX_FD和RLIMIT_NOFILE定好，之后不再扩容
+    // HttpConn在fd第一次使用时创建，关闭后留给下一个同号fd复用；指针直接放进epoll_event.data.ptr
+    std::vector<std::unique_ptr<HttpConn>> users_;
 };
 
 
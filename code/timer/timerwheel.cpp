@@ -0,0 +1,143 @@
+#include "timerwheel.h"
+
+TimerWheel::TimerWheel(): slots_(SLOTS, -1), current_(Now_()), count_(0) {
+    for(auto& w: bitmap_) { w = 0; }
+}
+
+int64_t TimerWheel::Now_() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 挂到when对应的槽上，when限制在[current_, current_ + SLOTS)内
+void TimerWheel::Link_(int id, int64_t when) {
+    WheelNode& node = nodes_[id];
+    assert(node.slotTime == -1);
+    if(when < current_) { when = current_; }
+    if(when > current_ + MASK) { when = current_ + MASK; }
+    int slot = static_cast<int>(when & MASK);
+    node.slotTime = when;
+    node.prev = -1;
+    node.next = slots_[slot];
+    if(node.next != -1) { nodes_[node.next].prev = id; }
+    slots_[slot] = id;
+    bitmap_[slot / 64] |= (1ULL << (slot % 64));
+    count_++;
+}
+
+void TimerWheel::Unlink_(int id) {
+    WheelNode& node = nodes_[id];
+    assert(node.slotTime != -1);
+    int slot = static_cast<int>(node.slotTime & MASK);
+    if(node.prev != -1) { nodes_[node.prev].next = node.next; }
+    else { slots_[slot] = node.next; }
+    if(node.next != -1) { nodes_[node.next].prev = node.prev; }
+    if(slots_[slot] == -1) { bitmap_[slot / 64] &= ~(1ULL << (slot % 64)); }
+    node.slotTime = -1;
+    node.prev = node.next = -1;
+    count_--;
+}
+
+// 从current_所在的槽开始顺着位图找第一个非空槽
+int64_t TimerWheel::NextSlotTime_() const {
+    if(count_ == 0) { return -1; }
+    int start = static_cast<int>(current_ & MASK);
+    int word = start / 64;
+    uint64_t bits = bitmap_[word] & (~0ULL << (start % 64));
+    for(int i = 0; i <= SLOTS / 64; i++) {
+        if(bits) {
+            int slot = word * 64 + __builtin_ctzll(bits);
+            return current_ + ((slot - start) & MASK);
+        }
+        word = (word + 1) % (SLOTS / 64);
+        bits = bitmap_[word];
+    }
+    return -1;
+}
+
+//id：fd，timeout：超时关闭时间，cd：超时时间到了之后的回调函数
+void TimerWheel::add(int id, int timeout, const TimeoutCallBack& cb) {
+    assert(id >= 0);
+    if(static_cast<size_t>(id) >= nodes_.size()) {
+        nodes_.resize(id + 1);
+    }
+    WheelNode& node = nodes_[id];
+    node.expires = Now_() + timeout;
+    node.cb = cb;
+    if(node.slotTime != -1) {
+        /* 已有结点：提前到期才需要挪动 */
+        if(node.expires >= node.slotTime) { return; }
+        Unlink_(id);
+    }
+    Link_(id, node.expires);
+}
+
+void TimerWheel::adjust(int id, int timeout) {
+    /* 调整指定id的结点，只记下新的到期时间，槽到点时再处理 */
+    assert(static_cast<size_t>(id) < nodes_.size() && nodes_[id].slotTime != -1);
+    WheelNode& node = nodes_[id];
+    node.expires = Now_() + timeout;
+    if(node.expires < node.slotTime) {
+        Unlink_(id);
+        Link_(id, node.expires);
+    }
+}
+
+void TimerWheel::doWork(int id) {
+    /* 删除指定id结点，并触发回调函数 */
+    if(static_cast<size_t>(id) >= nodes_.size() || nodes_[id].slotTime == -1) {
+        return;
+    }
+    Unlink_(id);
+    TimeoutCallBack cb = std::move(nodes_[id].cb);
+    cb();
+}
+
+void TimerWheel::del(int id) {
+    if(static_cast<size_t>(id) >= nodes_.size() || nodes_[id].slotTime == -1) {
+        return;
+    }
+    Unlink_(id);
+    nodes_[id].cb = nullptr;
+}
+
+void TimerWheel::tick() {
+    /* 清除超时结点 */
+    int64_t now = Now_();
+    while(count_ > 0) {
+        int64_t t = NextSlotTime_();
+        if(t > now) { break; }
+        current_ = t;
+        int slot = static_cast<int>(t & MASK);
+        while(slots_[slot] != -1) {
+            int id = slots_[slot];
+            Unlink_(id);
+            WheelNode& node = nodes_[id];
+            if(node.expires <= now) {
+                TimeoutCallBack cb = std::move(node.cb);
+                cb();
+            } else {
+                /* adjust推迟过，或者超过一圈，继续往后挂 */
+                Link_(id, node.expires);
+            }
+        }
+    }
+    current_ = now + 1;
+}
+
+void TimerWheel::clear() {
+    nodes_.clear();
+    slots_.assign(SLOTS, -1);
+    for(auto& w: bitmap_) { w = 0; }
+    count_ = 0;
+}
+
+//清除超时的节点，然后获取最先要超时的连接的超时的时间
+int TimerWheel::GetNextTick() {
+    tick();
+    int64_t next = NextSlotTime_();
+    if(next < 0) { return -1; }
+    /* tick()之后current_ = now + 1 */
+    int64_t res = next - (current_ - 1);
+    return res < 0 ? 0 : static_cast<int>(res);
+}
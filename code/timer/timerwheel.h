@@ -0,0 +1,64 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <assert.h>
+#include <stdint.h>
+#include "heaptimer.h"  // TimeoutCallBack
+
+// 时间轮上的定时器节点，按id(fd)存放在数组里，槽内用下标串成双向链表
+struct WheelNode {
+    int64_t expires = 0;    // 到期时间(ms)
+    int64_t slotTime = -1;  // 所在槽对应的时间(ms)，-1表示不在轮上
+    int prev = -1;
+    int next = -1;
+    TimeoutCallBack cb;     // 到期执行的回调
+};
+
+// 毫秒精度的哈希时间轮，接口和HeapTimer一样
+// add/adjust/doWork都是O(1)：adjust只改到期时间，不挪动节点(惰性)，
+// 节点所在的槽到点时才检查，没到期就按新的到期时间重新挂到轮上。
+// 超过一圈(SLOTS毫秒)的定时器先挂在一圈之后的槽上，到点再往后挂
+class TimerWheel {
+public:
+    TimerWheel();
+
+    ~TimerWheel() { clear(); }
+
+    void adjust(int id, int newExpires);
+
+    void add(int id, int timeOut, const TimeoutCallBack& cb);
+
+    void doWork(int id);
+
+    void del(int id);   // 删除指定id结点，不触发回调(连接已经关闭了)
+
+    void clear();
+
+    void tick();
+
+    //清除超时的节点，然后获取最先要超时的连接的超时的时间
+    int GetNextTick();
+
+private:
+    static const int SLOTS = 4096;  // 槽数，必须是2的幂
+    static const int MASK = SLOTS - 1;
+
+    static int64_t Now_();
+
+    void Link_(int id, int64_t when);
+
+    void Unlink_(int id);
+
+    int64_t NextSlotTime_() const;  // 最近的非空槽对应的时间，没有返回-1
+
+    std::vector<WheelNode> nodes_;  // 以id为下标
+    std::vector<int> slots_;        // 每个槽的链表头
+    uint64_t bitmap_[SLOTS / 64];   // 非空槽的位图
+    int64_t current_;               // 下一个要处理的时间(ms)
+    size_t count_;                  // 轮上的节点数
+};
+
+#endif //TIMER_WHEEL_H
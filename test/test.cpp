@@ -5,13 +5,100 @@
  */ 
 #include "../code/log/log.h"
 #include "../code/pool/threadpool.h"
+#include "../code/timer/heaptimer.h"
+#include "../code/timer/timerwheel.h"
+#include "../code/buffer/buffer.h"
+#include "../code/http/httprequest.h"
+#include "../code/http/filecache.h"
+#include "../code/http/httpconn.h"
+#include "../code/http/precompress.h"
+#include "../code/http/compresscache.h"
+#include "../code/http/filewatcher.h"
+#include "../code/server/uringpoller.h"
+#include <zlib.h>
+#include <regex>
 #include <features.h>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <netinet/tcp.h>
 
 #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
 #include <sys/syscall.h>
 #define gettid() syscall(SYS_gettid)
 #endif
 
+// 统计当前线程的内存分配次数
+static thread_local size_t t_allocCount = 0;
+
+// 替换全局的new/delete，数组和对齐的形式也成对替换；
+// free放在不内联的函数里，编译器看不到operator new的结果被free，不报-Wmismatched-new-delete
+static void* CountedAlloc(size_t size, size_t align) {
+    t_allocCount++;
+    if(size == 0) { size = 1; }
+    // aligned_alloc要求大小是对齐的整数倍
+    void* p = align > alignof(std::max_align_t)
+        ? aligned_alloc(align, (size + align - 1) / align * align) : malloc(size);
+    if(!p) { throw std::bad_alloc(); }
+    return p;
+}
+
+__attribute__((noinline)) static void CountedFree(void* p) noexcept { free(p); }
+
+void* operator new(size_t size) { return CountedAlloc(size, 0); }
+void* operator new[](size_t size) { return CountedAlloc(size, 0); }
+void* operator new(size_t size, std::align_val_t al) { return CountedAlloc(size, size_t(al)); }
+void* operator new[](size_t size, std::align_val_t al) { return CountedAlloc(size, size_t(al)); }
+
+void operator delete(void* p) noexcept { CountedFree(p); }
+void operator delete[](void* p) noexcept { CountedFree(p); }
+void operator delete(void* p, size_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, size_t) noexcept { CountedFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { CountedFree(p); }
+
+// 一对本地socket，fds[0]给HttpConn，fds[1]当客户端
+void MakeSocketPair(int fds[2]) {
+    int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(ret == 0);
+}
+
+// 客户端从peer发来req，conn读进来处理，返回process()的结果
+bool SendRequest(HttpConn& conn, int peer, const std::string& req, bool mayBlock = true) {
+    ssize_t n = ::write(peer, req.data(), req.size());
+    assert(n == (ssize_t)req.size());
+    int err = 0;
+    n = conn.read(&err);
+    assert(n > 0);
+    return conn.process(mayBlock);
+}
+
+// 后台线程从peer读到expected字节或者对端关闭为止，join之后got里是收到的数据
+std::thread ReadPeer(int peer, size_t expected, std::string& got) {
+    return std::thread([peer, expected, &got] {
+        char buf[65536];
+        while(got.size() < expected) {
+            ssize_t n = ::read(peer, buf, sizeof(buf));
+            if(n <= 0) { break; }
+            got.append(buf, n);
+        }
+    });
+}
+
+// 把conn发送队列里的响应发完
+void FlushConn(HttpConn& conn) {
+    int err = 0;
+    while(conn.ToWriteBytes()) {
+        ssize_t n = conn.write(&err);
+        assert(n > 0);
+    }
+}
+
 void TestLog() {
     int cnt = 0, level = 0;
     Log::Instance()->init(level, "./testlog1", ".log", 0);
@@ -41,16 +128,1290 @@ void ThreadLogTask(int i, int cnt) {
     }
 }
 
+// 模拟偷任务时被抢占的线程：从格子里移出任务(TryPop里CAS之后、还格子之前)时卡住，直到放行
+static thread_local bool t_thief = false;
+struct SlowMove {
+    static std::atomic<bool> entered;
+    static std::atomic<bool> release;
+    int v = 0;
+    SlowMove() = default;
+    explicit SlowMove(int x): v(x) {}
+    SlowMove& operator=(SlowMove&& other) {
+        if(t_thief) {
+            entered = true;
+            while(!release.load()) { std::this_thread::yield(); }
+        }
+        v = other.v;
+        return *this;
+    }
+};
+std::atomic<bool> SlowMove::entered(false);
+std::atomic<bool> SlowMove::release(false);
+
+// 线程池里的任务：第五次移动(放进批次、进全局队列、从全局队列取出、放进本地队列之后)
+// 如果不是放进本地队列的那个线程做的，就是被偷走了，卡在格子上直到放行，像偷任务的线程被抢占
+struct StealTask {
+    static std::atomic<bool> stalled;
+    static std::atomic<bool> release;
+    std::atomic<int>* done;
+    int moves = 0;
+    std::thread::id owner;
+    explicit StealTask(std::atomic<int>* d): done(d) {}
+    StealTask(StealTask&& other) noexcept: done(other.done), moves(other.moves + 1), owner(other.owner) {
+        if(moves == 4) { owner = std::this_thread::get_id(); }
+        if(moves == 5 && owner != std::this_thread::get_id()) {
+            stalled = true;
+            while(!release.load()) { std::this_thread::yield(); }
+        }
+    }
+    void operator()() { (*done)++; }
+};
+std::atomic<bool> StealTask::stalled(false);
+std::atomic<bool> StealTask::release(false);
+
+void TestWorkStealing() {
+    // 队列逻辑上是空的，但偷任务的线程还占着格子，入队绕一圈回来就放不下
+    SlowMove::entered = SlowMove::release = false;
+    WorkQueue<SlowMove> q(2);
+    bool ok = q.TryPush(SlowMove(1));
+    assert(ok);
+    std::thread thief([&q] {
+        t_thief = true;
+        SlowMove item;
+        bool got = q.TryPop(item);
+        assert(got && item.v == 1);
+    });
+    while(!SlowMove::entered.load()) { std::this_thread::yield(); }
+    SlowMove item;
+    ok = q.TryPush(SlowMove(2)) && q.TryPop(item) && item.v == 2;
+    assert(ok);
+    ok = q.TryPush(SlowMove(3));
+    assert(!ok);
+    SlowMove::release = true;
+    thief.join();
+    ok = q.TryPush(SlowMove(3));
+    assert(ok);
+
+    // 线程池：A卡在第一个任务里，B从A的本地队列偷走下一个任务时卡在格子上；
+    // A接着从全局队列往本地队列搬任务，绕一圈回到这个格子放不下，放不下的任务不能丢
+    std::atomic<int> done(0);
+    std::atomic<bool> blocked(false), unblock(false);
+    {
+        ThreadPool threadpool(2);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));   // 两个线程都睡下
+        StealTask::stalled = StealTask::release = false;
+        std::vector<Task> batch;
+        batch.reserve(8);
+        batch.emplace_back([&] {
+            blocked = true;
+            while(!unblock.load()) { std::this_thread::yield(); }
+            done++;
+        });
+        batch.emplace_back(StealTask(&done));
+        for(int i = 2; i < 8; i++) { batch.emplace_back([&done] { done++; }); }
+        threadpool.AddTasks(batch.begin(), batch.end());
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while(!StealTask::stalled.load() && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+        bool stolen = blocked.load() && StealTask::stalled.load();  // 多核上B可能直接从全局队列取走，没偷成
+        unblock = true;
+        const int more = 1024;
+        for(int k = 0; k < more / 8; k++) {
+            batch.clear();
+            for(int i = 0; i < 8; i++) { batch.emplace_back([&done] { done++; }); }
+            threadpool.AddTasks(batch.begin(), batch.end());
+            std::this_thread::yield();
+        }
+        // 除了卡住的那个，其余任务都要执行
+        deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        int expect = 8 + more - (stolen ? 1 : 0);
+        while(done.load() < expect && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+        assert(done.load() == expect);
+        StealTask::release = true;
+        while(done.load() < 8 + more) { std::this_thread::yield(); }
+    }
+
+    // 线程数远多于CPU时的压力测试
+    ThreadPool threadpool(std::max(32u, std::thread::hardware_concurrency() * 4));
+    const int total = 1 << 20;
+    done = 0;
+    std::vector<Task> batch;
+    for(int k = 0; k < total / 64; k++) {
+        for(int i = 0; i < 64; i++) { batch.emplace_back([&done] { done++; }); }
+        threadpool.AddTasks(batch.begin(), batch.end());
+        batch.clear();
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while(done.load() < total && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    assert(done.load() == total);
+}
+
 void TestThreadPool() {
     Log::Instance()->init(0, "./testThreadpool", ".log", 5000);
     ThreadPool threadpool(6);
+    // 大量小任务：每个任务都要执行且只执行一次
+    const int total = 1000000;
+    std::atomic<int> done(0);
+    auto begin = std::chrono::steady_clock::now();
+    for(int i = 0; i < total; i++) {
+        threadpool.AddTask([&done] { done++; });
+    }
+    while(done.load() < total) { std::this_thread::yield(); }
+    assert(done.load() == total);
+    printf("ThreadPool %d tasks: %.1f ms\n", total,
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+    // 批量提交：一次提交一个epoll_wait批次(1024)
+    done = 0;
+    begin = std::chrono::steady_clock::now();
+    std::vector<Task> batch;
+    for(int k = 0; k < total / 1024; k++) {
+        for(int i = 0; i < 1024; i++) {
+            batch.emplace_back([&done] { done++; });
+        }
+        threadpool.AddTasks(batch.begin(), batch.end());
+        batch.clear();
+    }
+    while(done.load() < total / 1024 * 1024) { std::this_thread::yield(); }
+    printf("ThreadPool %d tasks in batches: %.1f ms\n", total / 1024 * 1024,
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+
     for(int i = 0; i < 18; i++) {
         threadpool.AddTask(std::bind(ThreadLogTask, i % 4, i * 10000));
     }
     getchar();
 }
 
+// conns个连接各加一个定时器，再随机adjust rounds次，返回耗时(ms)
+template<class T>
+double BenchTimer(T& timer, int conns, int rounds) {
+    auto begin = std::chrono::steady_clock::now();
+    for(int i = 0; i < conns; i++) {
+        timer.add(i, 60000, []{});
+    }
+    std::mt19937 rng(1);
+    for(int i = 0; i < rounds; i++) {
+        timer.adjust(rng() % conns, 60000);
+    }
+    timer.GetNextTick();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+void TestTimer() {
+    TimerWheel wheel;
+    int fired = 0;
+    wheel.add(1, 10, [&] { fired += 1; });
+    wheel.add(2, 5000, [&] { fired += 100; });
+    wheel.add(3, 10, [&] { fired += 10000; });
+    wheel.adjust(3, 100000);    // 推迟到一圈之外
+    wheel.doWork(2);
+    assert(fired == 100);
+    usleep(30 * 1000);
+    int next = wheel.GetNextTick();
+    assert(fired == 101);
+    assert(next > 0);
+
+    // 多reactor模式：reactor A上的连接关闭后，同号fd被reactor B的新连接用上，
+    // A的旧定时器节点不能再到期关掉B的连接(CloseConn_关fd之前先del)
+    int fds[2], fds2[2];
+    MakeSocketPair(fds);
+    TimerWheel reactorA, reactorB;
+    HttpConn conn;
+    int fd = fds[0];
+    conn.init(fd, sockaddr_in());
+    reactorA.add(fd, 10, [&] { conn.Close(); });
+    reactorA.del(fd);
+    conn.Close();
+    close(fds[1]);
+    MakeSocketPair(fds2);
+    if(fds2[0] != fd) {     // 一般内核直接给最小的空闲号，就是刚关掉的fd；不是的话挪过去
+        int ret = dup2(fds2[0], fd);
+        assert(ret == fd);
+        close(fds2[0]);
+    }
+    conn.init(fd, sockaddr_in());
+    reactorB.add(fd, 60000, [&] { conn.Close(); });
+    usleep(30 * 1000);
+    assert(reactorA.GetNextTick() == -1);
+    assert(fcntl(fd, F_GETFD) != -1);  // 新连接还开着
+    conn.Close();
+    close(fds2[1]);
+
+    const int conns = 100000, rounds = 1000000;
+    HeapTimer heap;
+    TimerWheel wheel2;
+    printf("HeapTimer  %d conns %d adjust: %.1f ms\n", conns, rounds, BenchTimer(heap, conns, rounds));
+    printf("TimerWheel %d conns %d adjust: %.1f ms\n", conns, rounds, BenchTimer(wheel2, conns, rounds));
+}
+
+// 模拟WebServer的读任务派发
+struct FakeServer {
+    std::atomic<int> done{0};
+    void OnRead(int* client) { done++; }
+};
+
+struct FakeIoTask {
+    FakeServer* server;
+    int* client;
+    bool isWrite;
+    void operator()() const { server->OnRead(client); }
+};
+
+// 比较 std::function + std::bind 和 Task 派发时每个任务的分配次数(只统计提交线程)
+// 每次提交一个epoll_wait批次(1024)的任务，等执行完再提交下一批
+void TestTaskAlloc() {
+    const int batch = 1024, rounds = 100, total = batch * rounds;
+    FakeServer server;
+    int client = 0;
+    ThreadPool threadpool(4);
+
+    size_t bindAllocs = 0;
+    for(int k = 0; k < rounds; k++) {
+        size_t before = t_allocCount;
+        for(int i = 0; i < batch; i++) {
+            threadpool.AddTask(std::function<void()>(std::bind(&FakeServer::OnRead, &server, &client)));
+        }
+        bindAllocs += t_allocCount - before;
+        while(server.done.load() < (k + 1) * batch) { std::this_thread::yield(); }
+    }
+
+    size_t taskAllocs = 0;
+    for(int k = 0; k < rounds; k++) {
+        size_t before = t_allocCount;
+        for(int i = 0; i < batch; i++) {
+            threadpool.AddTask(FakeIoTask{&server, &client, false});
+        }
+        taskAllocs += t_allocCount - before;
+        while(server.done.load() < total + (k + 1) * batch) { std::this_thread::yield(); }
+    }
+
+    printf("allocs per task: std::function+bind %.2f, Task %.2f\n",
+        double(bindAllocs) / total, double(taskAllocs) / total);
+    assert(taskAllocs == 0);
+}
+
+void TestBuffer() {
+    Buffer buff;
+    std::string data;
+    for(int i = 0; i < 10000; i++) { data += char('a' + i % 26); }
+    buff.Append(data);
+    assert(buff.ReadableBytes() == data.size());
+    assert(buff.ContiguousBytes() < data.size());   // 跨了好几块
+
+    struct iovec iov[16];
+    int cnt = buff.PeekIov(iov, 16);
+    size_t total = 0;
+    for(int i = 0; i < cnt; i++) { total += iov[i].iov_len; }
+    assert(cnt > 1 && total == data.size());
+
+    buff.Retrieve(5000);
+    assert(std::string(buff.MakeContiguous(), buff.ReadableBytes()) == data.substr(5000));
+    assert(buff.ContiguousBytes() == buff.ReadableBytes());
+
+    /* 清空后重用同一块 */
+    buff.RetrieveAll();
+    buff.Append("GET", 3);
+    const char* p = buff.Peek();
+    buff.RetrieveAll();
+    buff.Append("GET", 3);
+    assert(buff.Peek() == p);
+
+    /* 大块读空后还回去，空闲时全部还回去 */
+    buff.EnsureWriteable(100000);
+    buff.HasWritten(100000);
+    buff.Retrieve(100003);
+    assert(buff.Capacity() == 0);
+    buff.Append("GET", 3);
+    buff.RetrieveAll();
+    assert(buff.Capacity() == ChunkPool::CHUNK_SIZE);
+    size_t used = ChunkPool::Instance()->UsedBytes();
+    buff.Shrink();
+    assert(buff.Capacity() == 0);
+    assert(ChunkPool::Instance()->UsedBytes() < used);
+
+    /* 经过管道读写，大于一块 */
+    int fds[2];
+    int ret = pipe(fds);
+    assert(ret == 0);
+    Buffer out, in;
+    out.Append(data);
+    int err = 0;
+    while(out.ReadableBytes()) {
+        ssize_t n = out.WriteFd(fds[1], &err);
+        assert(n > 0);
+    }
+    close(fds[1]);
+    while(in.ReadFd(fds[0], &err) > 0) {}
+    close(fds[0]);
+    assert(in.RetrieveAllToStr() == data);
+}
+
+// 原来基于std::regex的解析(每行拷贝成string再匹配)，作为基准
+size_t RegexParse(const std::string& req) {
+    size_t pos = 0, headers = 0;
+    bool requestLine = true;
+    while(pos < req.size()) {
+        size_t end = req.find("\r\n", pos);
+        if(end == std::string::npos) { end = req.size(); }
+        std::string line(req, pos, end - pos);
+        std::smatch subMatch;
+        if(requestLine) {
+            std::regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
+            if(!std::regex_match(line, subMatch, patten)) { return 0; }
+            requestLine = false;
+        } else {
+            std::regex patten("^([^:]*): ?(.*)$");
+            if(!std::regex_match(line, subMatch, patten)) { break; }
+            headers++;
+        }
+        pos = end + 2;
+    }
+    return headers;
+}
+
+void TestParser() {
+    const std::string req =
+        "GET /images/profile-image.jpg?size=large HTTP/1.1\r\n"
+        "Host: 127.0.0.1:1316\r\n"
+        "Connection: keep-alive\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "\r\n";
+    Buffer buff;
+    buff.Append(req);
+    HttpRequest request;
+    assert(request.parse(buff) && request.IsFinished());
+    assert(request.Consumed() == req.size());
+    assert(request.method() == "GET" && request.version() == "1.1");
+    assert(request.path() == "/images/profile-image.jpg?size=large");
+    assert(request.GetHeader("Accept-Encoding") == "gzip, deflate, br");
+    assert(request.IsKeepAlive());
+    assert(request.GetHeader("accept-language") == "zh-CN,zh;q=0.9,en;q=0.8");  // 不区分大小写
+    assert(request.GetHeader(HeaderTable::HOST) == "127.0.0.1:1316");
+
+    /* 解析一般的请求不分配内存 */
+    size_t allocs = t_allocCount;
+    for(int i = 0; i < 100; i++) {
+        request.Init();
+        assert(request.parse(buff) && request.IsFinished());
+    }
+    assert(t_allocCount == allocs);
+
+    /* 一个字节一个字节地到达，请求从一块的末尾开始(中途会被挪到新块)，接着上次的位置解析 */
+    const std::string post = "POST /form HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                             "Content-Length: 27\r\n\r\nusername=tiny&password=http";
+    for(const std::string* r: { &req, &post }) {
+        Buffer slow;
+        std::string filler(ChunkPool::DATA_SIZE - 20, 'x');
+        slow.Append(filler);
+        slow.Append(r->data(), 1);
+        slow.Retrieve(filler.size());
+        HttpRequest rq;
+        for(size_t i = 1; i <= r->size(); i++) {
+            assert(rq.parse(slow));
+            assert(rq.IsFinished() == (i == r->size()));
+            if(i < r->size()) { slow.Append(r->data() + i, 1); }
+        }
+        assert(rq.Consumed() == r->size());
+        assert(r == &req ? rq.GetHeader("Accept-Encoding") == "gzip, deflate, br"
+                         : rq.GetPost("password") == "http");
+    }
+
+    /* 不合法的请求 */
+    const char* bad[] = {
+        "GET  / HTTP/1.1\r\n\r\n",              // 两个空格
+        "GET / HTTP/1.1\r\nHost : x\r\n\r\n",     // 名字和冒号之间有空格
+        "GET / HTTP/1.1\r\n folded\r\n\r\n",      // 折行
+        "GET / HTTP/1.1\r\nX: a\x01b\r\n\r\n",     // 控制字符
+        "GET / HTTP/1.1\nHost: x\r\n\r\n",        // 单独的\n
+        "G(T / HTTP/1.1\r\n\r\n",
+        "GET / HTTX/1.1\r\n\r\n",
+    };
+    for(const char* r: bad) {
+        Buffer b;
+        b.Append(r, strlen(r));
+        HttpRequest rq;
+        assert(!rq.parse(b));
+    }
+
+    /* regex太慢，少跑一些，按每个请求的耗时比较 */
+    const int regexRounds = 5000, rounds = 200000;
+    auto begin = std::chrono::steady_clock::now();
+    size_t sum = 0;
+    for(int i = 0; i < regexRounds; i++) { sum += RegexParse(req); }
+    double regexNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+    assert(sum == 6 * regexRounds);
+    begin = std::chrono::steady_clock::now();
+    for(int i = 0; i < rounds; i++) {
+        request.Init();
+        request.parse(buff);
+        sum += request.Consumed();
+    }
+    double parseNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+    printf("parse per request: regex %.0f ns, HttpRequest %.0f ns\n", regexNs / regexRounds, parseNs / rounds);
+
+    /* 各种扫描实现结果一致；长请求头(cookie)的解析速度 */
+    std::string cookie = "Cookie: ";
+    for(int i = 0; i < 200; i++) { cookie += "session" + std::to_string(i) + "=abcdefghijklmnop; "; }
+    std::string bigReq = req.substr(0, req.size() - 2) + cookie + "\r\n\r\n";
+    Buffer bigBuff;
+    bigBuff.Append(bigReq);
+    std::string line(100, 'a');
+    const char* best = ByteScanner::Name();
+    for(const char* impl: { "scalar", "sse4.2", "avx2" }) {
+        if(!ByteScanner::Select(impl)) { continue; }
+        for(size_t i = 0; i < line.size(); i++) {
+            std::string l = line;
+            l[i] = (i % 2) ? '\r' : '=';
+            const char* b = l.data();
+            const char* e = b + l.size();
+            assert(ByteScanner::FindLineBreak(b, e) == ((i % 2) ? b + i : e));
+            assert(ByteScanner::FindAny(b, e, "&=", 2) == ((i % 2) ? e : b + i));
+        }
+        begin = std::chrono::steady_clock::now();
+        for(int i = 0; i < rounds / 10; i++) {
+            request.Init();
+            assert(request.parse(bigBuff) && request.IsFinished());
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+        printf("parse %zu-byte request with %s scanner: %.0f ns\n", bigReq.size(), impl, ns / (rounds / 10));
+    }
+    ByteScanner::Select(best);
+}
+
+void TestFileCache() {
+    FileCache* cache = FileCache::Instance();
+    std::string path = "testFileCache.txt";
+    FILE* fp = fopen(path.data(), "w");
+    fputs("hello", fp);
+    fclose(fp);
+
+    FilePtr a = cache->Get(path);
+    assert(a && a->size == 5 && memcmp(a->map, "hello", 5) == 0);
+    assert(a->mime == "text/plain");
+    assert(a->head[0] == "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-type: text/plain\r\nETag: " + a->etag
+                         + "\r\nLast-Modified: " + a->lastModified + "\r\nVary: Accept-Encoding\r\nAccept-Ranges: bytes\r\n"
+                         "Content-length: 5\r\n\r\n");
+    assert(a->head[1].find("Connection: keep-alive\r\n") != std::string::npos);
+    size_t hits = cache->Hits();
+    assert(cache->Get(path) == a && cache->Hits() == hits + 1);    // 命中，同一个条目
+    assert(!cache->Get("testFileCacheNone.txt") && !cache->Get("."));
+
+    // 淘汰后手里的引用仍然可以用
+    cache->Invalidate(path);
+    assert(memcmp(a->map, "hello", 5) == 0);
+    FilePtr b = cache->Get(path);
+    assert(b && b != a);
+
+    // 文件变了，确认时重新加载
+    cache->SetRevalidateMs(0);
+    fp = fopen(path.data(), "w");
+    fputs("hello world", fp);
+    fclose(fp);
+    FilePtr c = cache->Get(path);
+    assert(c != b && c->size == 11 && c->head[1].find("Content-length: 11\r\n") != std::string::npos);
+    cache->SetRevalidateMs(1000);
+
+    // 超过每片预算的文件不缓存
+    cache->SetBudget(16 * 4);
+    size_t bytes = cache->Bytes();
+    cache->Invalidate(path);
+    FilePtr d = cache->Get(path);
+    assert(d && cache->Get(path) != d && cache->Bytes() < bytes + d->size);
+    cache->SetBudget(64 << 20);
+    cache->Clear();
+    assert(cache->Bytes() == 0);
+    unlink(path.data());
+}
+
+// 本机TCP上比较 mmap+writev 和 sendfile 两种发文件的方式，用resources下面比较大的图片和字体
+void TestSendBody() {
+    const char* files[] = {
+        "/images/instagram-image4.jpg", "/fonts/FontAwesome.otf",
+        "/fonts/fontawesome-webfont.ttf", "/fonts/fontawesome-webfont.svg",
+    };
+    const int rounds = 500;
+    HttpConn::srcDir = "../resources/";
+    HttpConn::isET = false;
+
+    for(bool useSendfile: { false, true }) {
+        FileCache::Instance()->SetMapFiles(!useSendfile);
+        int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = { 0 };
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t addrLen = sizeof(addr);
+        int ret = bind(listenFd, (struct sockaddr*)&addr, addrLen);
+        assert(ret == 0);
+        listen(listenFd, 1);
+        getsockname(listenFd, (struct sockaddr*)&addr, &addrLen);
+        int clientFd = socket(AF_INET, SOCK_STREAM, 0);
+        ret = connect(clientFd, (struct sockaddr*)&addr, addrLen);
+        assert(ret == 0);
+        HttpConn conn;
+        int serverFd = accept(listenFd, nullptr, nullptr);
+        int one = 1;    // 同服务器sendfile模式的设置
+        setsockopt(serverFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn.init(serverFd, addr);
+
+        // 客户端一直读，需要时把收到的响应存下来检查
+        std::atomic<size_t> received(0);
+        std::atomic<bool> capture(false);
+        std::mutex mtx;
+        std::string got;
+        std::thread reader([&] {
+            char buf[65536];
+            ssize_t n;
+            while((n = ::read(clientFd, buf, sizeof(buf))) > 0) {
+                if(capture) {
+                    std::lock_guard<std::mutex> locker(mtx);
+                    got.append(buf, n);
+                }
+                received += n;
+            }
+        });
+        size_t expected = 0;
+        auto request = [&](const char* path) {
+            std::string req = std::string("GET ") + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+            bool queued = SendRequest(conn, clientFd, req);
+            assert(queued);
+            expected += conn.ToWriteBytes();
+            FlushConn(conn);
+            while(received < expected) { std::this_thread::yield(); }
+        };
+
+        for(const char* path: files) {
+            std::ifstream in(std::string(HttpConn::srcDir) + path, std::ios::binary);
+            std::stringstream content;
+            content << in.rdbuf();
+            capture = true;
+            request(path);
+            capture = false;
+            {
+                std::lock_guard<std::mutex> locker(mtx);
+                size_t head = got.find("\r\n\r\n");
+                assert(got.compare(0, 15, "HTTP/1.1 200 OK") == 0 && head != std::string::npos);
+                assert(got.substr(head + 4) == content.str());
+                got.clear();
+            }
+            auto begin = std::chrono::steady_clock::now();
+            size_t before = expected;
+            for(int i = 0; i < rounds; i++) { request(path); }
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+            printf("%-8s %-32s %7zu bytes: %6.1f us/response, %6.0f MB/s\n", useSendfile ? "sendfile" : "mmap",
+                   path, content.str().size(), us / rounds, (expected - before) / us);
+        }
+        conn.Close();
+        reader.join();
+        close(clientFd);
+        close(listenFd);
+    }
+    FileCache::Instance()->SetMapFiles(true);
+}
+
+void TestPrecompress() {
+    assert(HttpResponse::ParseAcceptEncoding("gzip, deflate, br") == (1 << FileEntry::GZIP | 1 << FileEntry::BROTLI));
+    assert(HttpResponse::ParseAcceptEncoding("br;q=0, GZIP;q=0.5") == 1 << FileEntry::GZIP);
+    assert(HttpResponse::ParseAcceptEncoding("*, gzip;q=0") == 1 << FileEntry::BROTLI);
+    assert(HttpResponse::ParseAcceptEncoding("identity, deflate") == 0);
+
+    std::string dir = "testPrecompress";
+    mkdir(dir.data(), 0755);
+    std::string css;
+    for(int i = 0; i < 2000; i++) { css += ".c" + std::to_string(i % 50) + " { color: red; }\n"; }
+    auto writeFile = [](const std::string& path, const std::string& data) {
+        FILE* fp = fopen(path.data(), "w");
+        fwrite(data.data(), 1, data.size(), fp);
+        fclose(fp);
+    };
+    writeFile(dir + "/a.css", css);
+    writeFile(dir + "/b.jpg", css);     // 图片不压缩
+    writeFile(dir + "/c.txt", "x");     // 压缩了不会变小
+    struct timespec past[2] = { { time(nullptr) - 10, 0 }, { time(nullptr) - 10, 0 } };
+    utimensat(AT_FDCWD, (dir + "/a.css").data(), past, 0);
+    utimensat(AT_FDCWD, (dir + "/c.txt").data(), past, 0);
+    assert(Precompressor::Run(dir) == 2);
+    assert(Precompressor::Run(dir) == 0);   // 已经是新的
+
+    // 没变小的记了标记，源文件没改过就不再压缩；改了以后重新压缩，标记删掉
+    std::string noGain[] = { dir + "/c.txt.gz" + Precompressor::NO_GAIN_SUFFIX,
+                             dir + "/c.txt.br" + Precompressor::NO_GAIN_SUFFIX };
+    for(const auto& marker: noGain) { assert(access(marker.data(), F_OK) == 0); }
+    writeFile(dir + "/c.txt", css);
+    utimensat(AT_FDCWD, (dir + "/c.txt").data(), past, 0);
+    assert(Precompressor::Run(dir) == 0);
+    assert(access((dir + "/c.txt.gz").data(), F_OK) < 0);
+    utimensat(AT_FDCWD, (dir + "/c.txt").data(), nullptr, 0);
+    assert(Precompressor::Run(dir) == 2);
+    for(const auto& marker: noGain) { assert(access(marker.data(), F_OK) < 0); }
+    // 又变得压不小了，旧的预压缩文件删掉
+    writeFile(dir + "/c.txt", "x");
+    struct timespec future[2] = { { time(nullptr) + 10, 0 }, { time(nullptr) + 10, 0 } };
+    utimensat(AT_FDCWD, (dir + "/c.txt").data(), future, 0);
+    assert(Precompressor::Run(dir) == 0);
+    assert(access((dir + "/c.txt.gz").data(), F_OK) < 0 && access((dir + "/c.txt.br").data(), F_OK) < 0);
+    for(const auto& marker: noGain) { assert(access(marker.data(), F_OK) == 0); }
+
+    // gzip能解回原文
+    std::ifstream in(dir + "/a.css.gz", std::ios::binary);
+    std::stringstream content;
+    content << in.rdbuf();
+    std::string gz = content.str();
+    std::string plain(css.size() + 1, '\0');
+    z_stream z = {};
+    inflateInit2(&z, 15 + 16);
+    z.next_in = (Bytef*)gz.data();
+    z.avail_in = gz.size();
+    z.next_out = (Bytef*)&plain[0];
+    z.avail_out = plain.size();
+    assert(inflate(&z, Z_FINISH) == Z_STREAM_END);
+    plain.resize(z.total_out);
+    assert(plain == css);
+    inflateEnd(&z);
+
+    FilePtr entry = FileCache::Instance()->Get(dir + "/a.css");
+    assert(entry && entry->variant[FileEntry::GZIP] && entry->variant[FileEntry::BROTLI]);
+    assert(entry->variant[FileEntry::BROTLI]->size < entry->variant[FileEntry::GZIP]->size);
+    assert(entry->head[1].find("Vary: Accept-Encoding\r\n") != std::string::npos);
+    assert(entry->head[1].find("Content-Encoding") == std::string::npos);
+
+    // 按Accept-Encoding选版本
+    std::string path = "/a.css";
+    HttpResponse response;
+    Buffer buff;
+    response.Init(dir, path, true, 200, "gzip;q=1.0, br");
+    response.MakeResponse(buff);
+    assert(buff.ReadableBytes() == 0 && response.FileLen() == entry->variant[FileEntry::BROTLI]->size);
+    assert(response.PrebuiltHead().find("Content-Encoding: br\r\n") != std::string::npos);
+    response.Init(dir, path, false, 200, "gzip");
+    response.MakeResponse(buff);
+    assert(response.PrebuiltHead() == entry->variant[FileEntry::GZIP]->head[0]);
+    response.Init(dir, path, true, 200);
+    response.MakeResponse(buff);
+    assert(response.FileLen() == css.size());
+
+    // 源文件比预压缩文件新，预压缩文件过期不用，重新生成后再用
+    writeFile(dir + "/a.css", css + "\n");
+    FileCache::Instance()->Invalidate(dir + "/a.css");
+    entry = FileCache::Instance()->Get(dir + "/a.css");
+    assert(!entry->variant[FileEntry::GZIP] && !entry->variant[FileEntry::BROTLI]);
+    assert(Precompressor::Run(dir) == 2);
+    entry = FileCache::Instance()->Get(dir + "/a.css");
+    assert(entry->variant[FileEntry::GZIP] && entry->variant[FileEntry::BROTLI]);
+
+    response.UnmapFile();
+    entry.reset();
+    FileCache::Instance()->Clear();
+    for(const char* name: { "/a.css", "/a.css.gz", "/a.css.br", "/b.jpg", "/c.txt",
+                            "/c.txt.gz.nogain", "/c.txt.br.nogain" }) {
+        unlink((dir + name).data());
+    }
+    rmdir(dir.data());
+}
+
+void TestCompressCache() {
+    CompressCache* cache = CompressCache::Instance();
+    std::string dir = "testCompress";
+    mkdir(dir.data(), 0755);
+    std::string js;
+    for(int i = 0; i < 20000; i++) { js += "var v" + std::to_string(i % 300) + " = " + std::to_string(i) + ";\n"; }
+    FILE* fp = fopen((dir + "/a.js").data(), "w");
+    fputs(js.data(), fp);
+    fclose(fp);
+    fp = fopen((dir + "/b.js").data(), "w");
+    fputs("var a;", fp);    // 太小不压缩
+    fclose(fp);
+
+    FilePtr file = FileCache::Instance()->Get(dir + "/a.js");
+    assert(file && file->mime == "text/javascript" && !cache->Get(file));     // 还没开启
+    cache->SetLevel(6);
+    cache->SetInlineMax(1 << 20);   // a.js(三百多KB)先在调用线程里压缩
+    assert(!cache->Get(FileCache::Instance()->Get(dir + "/b.js")));
+
+    for(bool mapFiles: { true, false }) {
+        FileCache::Instance()->SetMapFiles(mapFiles);   // 从映射或者fd读
+        file = FileCache::Instance()->Get(dir + "/a.js");
+        size_t misses = cache->Misses();
+        auto begin = std::chrono::steady_clock::now();
+        FilePtr gz = cache->Get(file);
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+        assert(gz && gz->encoding == FileEntry::GZIP && gz->size < file->size && cache->Misses() == misses + 1);
+        assert(gz->head[1].find("Content-Encoding: gzip\r\n") != std::string::npos);
+        begin = std::chrono::steady_clock::now();
+        assert(cache->Get(file) == gz);     // 同一个版本只压缩一次
+        double hitUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+        printf("gzip %zu -> %zu bytes: compress %.0f us, cached %.1f us\n", file->size, gz->size, us, hitUs);
+
+        std::string plain(file->size + 1, '\0');
+        z_stream z = {};
+        inflateInit2(&z, 15 + 16);
+        z.next_in = (Bytef*)gz->map;
+        z.avail_in = gz->size;
+        z.next_out = (Bytef*)&plain[0];
+        z.avail_out = plain.size();
+        assert(inflate(&z, Z_FINISH) == Z_STREAM_END);
+        plain.resize(z.total_out);
+        assert(plain == js);
+        inflateEnd(&z);
+        cache->Clear();
+    }
+    FileCache::Instance()->SetMapFiles(true);
+
+    // 同一个版本同时来很多请求只压缩一次，没轮上的先发原文件
+    {
+        file = FileCache::Instance()->Get(dir + "/a.js");
+        size_t misses = cache->Misses();
+        std::vector<std::thread> threads;
+        for(int i = 0; i < 8; i++) { threads.emplace_back([&] { cache->Get(file); }); }
+        for(auto& t: threads) { t.join(); }
+        assert(cache->Misses() == misses + 1 && cache->Get(file));
+    }
+
+    // 压缩了不变小(随机数据)的记下来，不再重复压缩
+    {
+        std::mt19937 rng(1);
+        std::string noise;
+        for(int i = 0; i < 8192; i++) { noise += char(rng()); }
+        fp = fopen((dir + "/c.js").data(), "w");
+        fwrite(noise.data(), 1, noise.size(), fp);
+        fclose(fp);
+        FilePtr c = FileCache::Instance()->Get(dir + "/c.js");
+        size_t misses = cache->Misses(), hits = cache->Hits();
+        assert(!cache->Get(c) && !cache->Get(c) && !cache->Get(c));
+        assert(cache->Misses() == misses + 1 && cache->Hits() == hits + 2);
+    }
+
+    // 事件循环线程里、或者文件比inlineMax大时交给后台压缩，这次先发原文件
+    auto waitGzip = [&](const FilePtr& f) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        FilePtr gz;
+        while(!(gz = cache->Get(f, false)) && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return gz;
+    };
+    for(bool onLoop: { true, false }) {
+        cache->Clear();
+        cache->SetInlineMax(onLoop ? 1 << 20 : 1024);
+        file = FileCache::Instance()->Get(dir + "/a.js");
+        size_t misses = cache->Misses();
+        auto begin = std::chrono::steady_clock::now();
+        FilePtr gz = cache->Get(file, !onLoop);
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+        assert(!gz && cache->Misses() == misses + 1);
+        gz = waitGzip(file);
+        assert(gz && gz->size < file->size && cache->Misses() == misses + 1);
+        printf("gzip in background (%s): miss returned in %.0f us\n", onLoop ? "loop thread" : "over inline max", us);
+    }
+    cache->Clear();
+    cache->SetInlineMax(1 << 20);
+
+    // 客户端接受gzip又没有预压缩文件时用现场压缩的结果；文件变了重新压缩
+    std::string path = "/a.js";
+    HttpResponse response;
+    Buffer buff;
+    response.Init(dir, path, true, 200, "gzip");
+    response.MakeResponse(buff);
+    FilePtr gz = cache->Get(FileCache::Instance()->Get(dir + "/a.js"));
+    assert(response.PrebuiltHead() == gz->head[1] && response.File() == gz->map);
+    struct timespec later[2] = { { time(nullptr) + 10, 0 }, { time(nullptr) + 10, 0 } };
+    utimensat(AT_FDCWD, (dir + "/a.js").data(), later, 0);
+    FileCache::Instance()->Invalidate(dir + "/a.js");
+    assert(cache->Get(FileCache::Instance()->Get(dir + "/a.js")) != gz);
+
+    response.UnmapFile();
+    cache->Clear();
+    cache->SetLevel(0);
+    cache->SetInlineMax(64 << 10);
+    FileCache::Instance()->Clear();
+    unlink((dir + "/a.js").data());
+    unlink((dir + "/b.js").data());
+    unlink((dir + "/c.js").data());
+    rmdir(dir.data());
+}
+
+void TestConditional() {
+    std::string dir = "testConditional";
+    mkdir(dir.data(), 0755);
+    FILE* fp = fopen((dir + "/a.png").data(), "w");
+    fputs("png", fp);
+    fclose(fp);
+    struct stat st;
+    stat((dir + "/a.png").data(), &st);
+    std::string etag = FileEntry::MakeETag(st);
+    std::string date = FileEntry::HttpDate(st.st_mtim.tv_sec);
+
+    assert(HttpResponse::MatchETag("\"x\", W/" + etag, etag) == etag);
+    std::string gz = etag.substr(0, etag.size() - 1) + "+gz\"";
+    assert(HttpResponse::MatchETag(gz, etag) == gz);
+    assert(HttpResponse::MatchETag(etag.substr(0, etag.size() - 1) + "0\"", etag).empty());
+    assert(HttpResponse::MatchETag(" * ", etag) == "*");
+
+    std::string path = "/a.png";
+    HttpResponse response;
+    Buffer buff;
+    auto make = [&](std::string_view ifNoneMatch, std::string_view ifModifiedSince) {
+        buff.RetrieveAll();
+        response.Init(dir, path, true, 200);
+        response.SetConditions(ifNoneMatch, ifModifiedSince);
+        response.MakeResponse(buff);
+        return response.Code();
+    };
+    // 没缓存时只stat，不打开文件
+    FileCache::Instance()->Clear();
+    size_t misses = FileCache::Instance()->Misses();
+    assert(make(etag, "") == 304 && FileCache::Instance()->Misses() == misses);
+    std::string head(buff.MakeContiguous(), buff.ReadableBytes());
+    assert(head.find("HTTP/1.1 304 Not Modified\r\n") == 0 && head.find("ETag: " + etag + "\r\n") != std::string::npos);
+    assert(head.find("Content-length") == std::string::npos && head.size() >= 4 && head.substr(head.size() - 4) == "\r\n\r\n");
+    assert(response.FileLen() == 0 && response.PrebuiltHead().empty());
+    assert(make("\"other\"", date) == 200);  // 有If-None-Match时不看If-Modified-Since
+    assert(response.PrebuiltHead().find("ETag: " + etag + "\r\nLast-Modified: " + date) != std::string::npos);
+
+    // 缓存里有的用缓存的元数据
+    FilePtr entry = FileCache::Instance()->Get(dir + "/a.png");
+    size_t hits = FileCache::Instance()->Hits();
+    assert(make("", date) == 304 && FileCache::Instance()->Hits() == hits + 1);
+    assert(make("", "Thu, 01 Jan 1970 00:00:00 GMT") == 200);
+    assert(make("", "not a date") == 200);
+
+    response.UnmapFile();
+    entry.reset();
+    FileCache::Instance()->Clear();
+    unlink((dir + "/a.png").data());
+    rmdir(dir.data());
+}
+
+// 通过socketpair让conn处理一个请求，返回完整的响应
+std::string Roundtrip(HttpConn& conn, int peer, const std::string& req) {
+    bool queued = SendRequest(conn, peer, req);
+    assert(queued);
+    std::string got;
+    std::thread reader = ReadPeer(peer, conn.ToWriteBytes(), got);
+    FlushConn(conn);
+    reader.join();
+    return got;
+}
+
+void TestRange() {
+    std::vector<HttpResponse::Segment> ranges;
+    assert(HttpResponse::ParseRange("bytes=0-499, 1000-, -200", 2000, ranges) && ranges.size() == 3);
+    assert(ranges[0].offset == 0 && ranges[0].len == 500 && ranges[1].offset == 1000 && ranges[1].len == 1000);
+    assert(ranges[2].offset == 1800 && ranges[2].len == 200);
+    assert(HttpResponse::ParseRange("bytes=100-99999", 2000, ranges) && ranges[0].len == 1900);
+    assert(HttpResponse::ParseRange("bytes=5000-, -0", 2000, ranges) && ranges.empty());   // 都不能满足
+    assert(!HttpResponse::ParseRange("bytes=9-1", 2000, ranges));
+    assert(!HttpResponse::ParseRange("items=0-1", 2000, ranges));
+    assert(!HttpResponse::ParseRange("bytes=a-b", 2000, ranges));
+    std::string many = "bytes=0-0";
+    for(int i = 1; i < 20; i++) { many += "," + std::to_string(i) + "-" + std::to_string(i); }
+    assert(!HttpResponse::ParseRange(many, 2000, ranges));
+
+    std::string dir = "testRange";
+    mkdir(dir.data(), 0755);
+    std::string data;
+    for(int i = 0; i < 100000; i++) { data += char('a' + i * 7 % 26); }
+    FILE* fp = fopen((dir + "/v.mpg").data(), "w");
+    fwrite(data.data(), 1, data.size(), fp);
+    fclose(fp);
+
+    int fds[2];
+    MakeSocketPair(fds);
+    HttpConn::srcDir = "testRange";
+    HttpConn::isET = false;
+    HttpConn conn;
+    conn.init(fds[0], sockaddr_in());
+    auto body = [](const std::string& resp) { return resp.substr(resp.find("\r\n\r\n") + 4); };
+
+    // 映射的文件和太大不映射(sendfile)的文件都试一下
+    for(size_t budget: { size_t(64) << 20, size_t(16) * 1000 }) {
+        FileCache::Instance()->SetBudget(budget);
+        FileCache::Instance()->Clear();
+        FilePtr file = FileCache::Instance()->Get(dir + "/v.mpg");
+        assert(file && (file->map != nullptr) == (budget > 16 * 100000));
+
+        std::string resp = Roundtrip(conn, fds[1], "GET /v.mpg HTTP/1.1\r\nRange: bytes=10-109\r\n\r\n");
+        assert(resp.find("HTTP/1.1 206 Partial Content\r\n") == 0);
+        assert(resp.find("Content-Range: bytes 10-109/100000\r\n") != std::string::npos);
+        assert(body(resp) == data.substr(10, 100));
+
+        resp = Roundtrip(conn, fds[1], "GET /v.mpg HTTP/1.1\r\nRange: bytes=0-9,50000-50009,-5\r\n\r\n");
+        std::string boundary = "range_" + file->etag.substr(1, file->etag.size() - 2);
+        assert(resp.find("Content-type: multipart/byteranges; boundary=" + boundary + "\r\n") != std::string::npos);
+        std::string expect = "\r\n--" + boundary + "\r\nContent-type: video/mpeg\r\nContent-Range: bytes 0-9/100000\r\n\r\n"
+            + data.substr(0, 10) + "\r\n--" + boundary + "\r\nContent-type: video/mpeg\r\nContent-Range: bytes 50000-50009/100000\r\n\r\n"
+            + data.substr(50000, 10) + "\r\n--" + boundary + "\r\nContent-type: video/mpeg\r\nContent-Range: bytes 99995-99999/100000\r\n\r\n"
+            + data.substr(99995) + "\r\n--" + boundary + "--\r\n";
+        assert(body(resp) == expect);
+        assert(resp.find("Content-length: " + std::to_string(expect.size()) + "\r\n") != std::string::npos);
+
+        resp = Roundtrip(conn, fds[1], "GET /v.mpg HTTP/1.1\r\nRange: bytes=100000-\r\n\r\n");
+        assert(resp.find("HTTP/1.1 416 Range Not Satisfiable\r\n") == 0 && body(resp).empty());
+        assert(resp.find("Content-Range: bytes */100000\r\n") != std::string::npos);
+
+        // If-Range对得上才按Range发
+        resp = Roundtrip(conn, fds[1], "GET /v.mpg HTTP/1.1\r\nRange: bytes=0-0\r\nIf-Range: " + file->etag + "\r\n\r\n");
+        assert(resp.find("HTTP/1.1 206") == 0 && body(resp) == data.substr(0, 1));
+        resp = Roundtrip(conn, fds[1], "GET /v.mpg HTTP/1.1\r\nRange: bytes=0-0\r\nIf-Range: \"old\"\r\n\r\n");
+        assert(resp.find("HTTP/1.1 200 OK\r\n") == 0 && resp.find("Accept-Ranges: bytes\r\n") != std::string::npos);
+        assert(body(resp) == data);
+    }
+    conn.Close();
+    close(fds[1]);
+    FileCache::Instance()->SetBudget(64 << 20);
+    FileCache::Instance()->Clear();
+    unlink((dir + "/v.mpg").data());
+    rmdir(dir.data());
+}
+
+// 大文件不映射、不进缓存，一次write最多发WRITE_BUDGET，剩下的下次接着发
+void TestStream() {
+    std::string dir = "testStream";
+    mkdir(dir.data(), 0755);
+    std::string data;
+    for(int i = 0; i < (12 << 20); i++) { data += char('a' + i * 13 % 26); }
+    FILE* fp = fopen((dir + "/big.mp4").data(), "w");
+    fwrite(data.data(), 1, data.size(), fp);
+    fclose(fp);
+
+    int fds[2];
+    MakeSocketPair(fds);
+    HttpConn::srcDir = "testStream";
+    HttpConn::isET = false;
+    HttpConn conn;
+    conn.init(fds[0], sockaddr_in());
+    FileCache::Instance()->Clear();
+
+    bool queued = SendRequest(conn, fds[1], "GET /big.mp4 HTTP/1.1\r\n\r\n");
+    assert(queued);
+    FilePtr file = FileCache::Instance()->Get(dir + "/big.mp4");
+    assert(file && file->map == nullptr && FileCache::Instance()->Bytes() == 0);
+    std::string got;
+    std::thread reader = ReadPeer(fds[1], conn.ToWriteBytes(), got);
+    HttpConn::isET = true;      // ET模式会一直写到EAGAIN，预算必须能让它停下来
+    size_t hits = HttpConn::writeBudgetHits;
+    int err = 0, turns = 0;
+    while(conn.ToWriteBytes()) {
+        size_t before = conn.ToWriteBytes();
+        ssize_t len = conn.write(&err);
+        size_t sent = before - conn.ToWriteBytes();
+        assert(sent <= HttpConn::WRITE_BUDGET + HttpConn::STREAM_CHUNK);
+        if(conn.ToWriteBytes()) { assert(len < 0 && err == EAGAIN && sent >= HttpConn::WRITE_BUDGET); }
+        turns++;
+    }
+    reader.join();
+    assert(turns >= 3 && HttpConn::writeBudgetHits - hits == size_t(turns - 1));
+    assert(got.compare(0, 15, "HTTP/1.1 200 OK") == 0 && got.substr(got.find("\r\n\r\n") + 4) == data);
+
+    // 超过4GiB的文件(稀疏文件，不占磁盘)：还没发的字节数不能被截断
+    const size_t hugeSize = (size_t(4) << 30) + 10;
+    int hugeFd = open((dir + "/huge.mp4").data(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int ret = ftruncate(hugeFd, hugeSize);
+    assert(hugeFd >= 0 && ret == 0);
+    close(hugeFd);
+    HttpConn::isET = false;
+    queued = SendRequest(conn, fds[1], "GET /huge.mp4 HTTP/1.1\r\n\r\n");
+    assert(queued && conn.ToWriteBytes() > hugeSize && conn.ToWriteBytes() < hugeSize + 1024);
+
+    conn.Close();
+    close(fds[1]);
+    FileCache::Instance()->Clear();
+    unlink((dir + "/big.mp4").data());
+    unlink((dir + "/huge.mp4").data());
+    rmdir(dir.data());
+}
+
+// 流水线：一次发来的多个请求按顺序排进发送队列，中间有404，最后一个Connection: close后面的请求不再处理；
+// 发送缓冲区很小，响应头和文件内容都会在中间被截断，分好多次写完
+void TestPipeline() {
+    HttpConn::srcDir = "../resources/";
+    HttpConn::isET = false;
+    auto readFile = [](const std::string& path) {
+        std::ifstream in(std::string(HttpConn::srcDir) + path, std::ios::binary);
+        std::stringstream content;
+        content << in.rdbuf();
+        return content.str();
+    };
+    for(bool mapFiles: { true, false }) {
+        FileCache::Instance()->SetMapFiles(mapFiles);   // writev映射的文件 / sendfile
+        FileCache::Instance()->Clear();
+        int fds[2];
+        MakeSocketPair(fds);
+        int sndBuf = 4096;
+        setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndBuf, sizeof(sndBuf));
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        HttpConn conn;
+        conn.init(fds[0], sockaddr_in());
+
+        std::vector<std::pair<int, std::string>> expect;    // 状态码和内容
+        std::string reqs;
+        for(int i = 0; i < 12; i++) {
+            reqs += "GET /index.html HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+            expect.emplace_back(200, readFile("/index.html"));
+            reqs += "GET /nope" + std::to_string(i) + ".html HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+            expect.emplace_back(404, readFile("/404.html"));
+            reqs += "GET /js/jquery.js HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+            expect.emplace_back(200, readFile("/js/jquery.js"));
+        }
+        reqs += "GET /welcome.html HTTP/1.1\r\nConnection: close\r\n\r\n";
+        expect.emplace_back(200, readFile("/welcome.html"));
+        reqs += "GET /login.html HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";    // 不会处理
+
+        bool queued = SendRequest(conn, fds[1], reqs);
+        assert(queued && !conn.IsKeepAlive() && conn.PendingResponses() == expect.size());
+        std::string got;
+        std::thread reader = ReadPeer(fds[1], conn.ToWriteBytes(), got);
+        int err = 0, partial = 0;
+        while(conn.ToWriteBytes()) {
+            ssize_t n = conn.write(&err);
+            if(n < 0) {
+                assert(err == EAGAIN);
+                partial++;
+                std::this_thread::yield();
+            }
+        }
+        reader.join();
+        assert(partial > 0 && conn.PendingResponses() == 0);
+
+        // 按顺序逐个解析响应
+        size_t pos = 0;
+        for(const auto& e: expect) {
+            size_t headEnd = got.find("\r\n\r\n", pos);
+            assert(headEnd != std::string::npos);
+            std::string head = got.substr(pos, headEnd + 4 - pos);
+            assert(head.compare(0, 12, "HTTP/1.1 " + std::to_string(e.first)) == 0);
+            size_t lenPos = head.find("Content-length: ");
+            assert(lenPos != std::string::npos);
+            size_t bodyLen = std::stoul(head.substr(lenPos + 16));
+            assert(bodyLen == e.second.size() && got.compare(headEnd + 4, bodyLen, e.second) == 0);
+            pos = headEnd + 4 + bodyLen;
+        }
+        assert(pos == got.size());  // 后面那个请求没有响应
+        conn.Close();
+        close(fds[1]);
+    }
+    FileCache::Instance()->SetMapFiles(true);
+    FileCache::Instance()->Clear();
+}
+
+// 客户端一下子发来很多数据，ET模式下一次read也只读READ_BUDGET左右，剩下的下次再读
+void TestReadBudget() {
+    int fds[2];
+    MakeSocketPair(fds);
+    int bufSize = 4 << 20;
+    setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &bufSize, sizeof(bufSize));
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof(bufSize));
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    std::string data(1 << 20, 'x');
+    size_t written = 0;
+    while(written < data.size()) {
+        ssize_t n = ::write(fds[1], data.data() + written, data.size() - written);
+        assert(n > 0);
+        written += n;
+    }
+
+    HttpConn::isET = true;
+    HttpConn conn;
+    conn.init(fds[0], sockaddr_in());
+    size_t hits = HttpConn::readBudgetHits;
+    int err = 0, turns = 0;
+    while(conn.read(&err) > 0) { turns++; }
+    assert(err == EAGAIN);
+    assert(turns > 1 && HttpConn::readBudgetHits - hits == size_t(turns));   // 每次都是用完预算停下的
+    conn.Close();
+    close(fds[1]);
+    HttpConn::isET = false;
+}
+
+void TestFileWatcher() {
+    std::string dir = "testWatch";
+    mkdir(dir.data(), 0755);
+    auto writeFile = [](const std::string& path, const std::string& data) {
+        FILE* fp = fopen(path.data(), "w");
+        fwrite(data.data(), 1, data.size(), fp);
+        fclose(fp);
+    };
+    // 后台线程处理完事件之前等一会儿
+    auto waitFor = [](const std::function<bool()>& done) {
+        for(int i = 0; i < 400 && !done(); i++) { std::this_thread::sleep_for(std::chrono::milliseconds(5)); }
+        return done();
+    };
+    std::string css;
+    for(int i = 0; i < 200; i++) { css += ".w" + std::to_string(i) + " { color: blue; }\n"; }
+    writeFile(dir + "/a.css", css);
+
+    FileCache* cache = FileCache::Instance();
+    int revalidateMs = cache->RevalidateMs();
+    FileWatcher watcher;
+    assert(watcher.Start(dir) && watcher.IsRunning() && cache->RevalidateMs() < 0);
+    FilePtr entry = cache->Get(dir + "/a.css");
+    assert(entry && entry->size == css.size());
+
+    // 改写：不用stat确认，监视到了就重新加载
+    writeFile(dir + "/a.css", css + css);
+    assert(waitFor([&] { return cache->Get(dir + "/a.css")->size == 2 * css.size(); }));
+
+    // 生成.gz/.br(临时文件+rename)后源文件带上预压缩版本
+    assert(Precompressor::Run(dir) == 2);
+    assert(waitFor([&] {
+        FilePtr e = cache->Get(dir + "/a.css");
+        return e->variant[FileEntry::GZIP] && e->variant[FileEntry::BROTLI];
+    }));
+    unlink((dir + "/a.css.br").data());
+    assert(waitFor([&] { return !cache->Get(dir + "/a.css")->variant[FileEntry::BROTLI]; }));
+
+    // 新目录里新写的文件提前加载好了：Stat只看缓存，不会去加载
+    auto cached = [&](const std::string& path) {
+        FilePtr e;
+        struct stat st;
+        return cache->Stat(path, e, st) && e;
+    };
+    mkdir((dir + "/sub").data(), 0755);
+    writeFile(dir + "/sub/b.js", "var b = 1;");
+    assert(waitFor([&] { return cached(dir + "/sub/b.js"); }));
+
+    // 删除
+    unlink((dir + "/sub/b.js").data());
+    assert(waitFor([&] { return !cache->Get(dir + "/sub/b.js"); }));
+
+    watcher.Stop();
+    assert(!watcher.IsRunning() && cache->RevalidateMs() == revalidateMs);
+    entry.reset();
+    cache->Clear();
+    rmdir((dir + "/sub").data());
+    for(const char* name: { "/a.css", "/a.css.gz" }) {
+        unlink((dir + name).data());
+    }
+    rmdir(dir.data());
+}
+
+// 事件循环线程里处理流水线：GET照常生成响应，停在后面要查数据库的登录请求前面，交给线程池接着处理
+void TestBlockingRequest() {
+    int fds[2];
+    MakeSocketPair(fds);
+    HttpConn::srcDir = "../resources/";
+    HttpConn::isET = false;
+    HttpConn conn;
+    conn.init(fds[0], sockaddr_in());
+    const std::string reqs = "GET /index.html HTTP/1.1\r\n\r\n"
+        "POST /login HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+        "Content-Length: 27\r\n\r\nusername=tiny&password=http";
+    bool queued = SendRequest(conn, fds[1], reqs, false);
+    assert(queued && conn.ToWriteBytes() > 0 && conn.IsBlockingRequest());
+    size_t pending = conn.ToWriteBytes();
+    queued = conn.process(false);     // 还是停在登录请求前面
+    assert(!queued && conn.IsBlockingRequest() && conn.ToWriteBytes() == pending);
+
+    // 普通的POST不查数据库，照常处理
+    HttpConn other;
+    int fds2[2];
+    MakeSocketPair(fds2);
+    other.init(fds2[0], sockaddr_in());
+    const std::string form = "POST /index.html HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+        "Content-Length: 3\r\n\r\na=b";
+    queued = SendRequest(other, fds2[1], form, false);
+    assert(queued && !other.IsBlockingRequest());
+
+    conn.Close();
+    other.Close();
+    close(fds[1]);
+    close(fds2[1]);
+}
+
+// io_uring：multishot accept直接交出连接，recv完成时带着数据，对端关闭报EPOLLRDHUP
+void TestUringPoller() {
+    UringPoller poller;
+    if(!poller.IsValid()) { return; }   // 内核不支持io_uring
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    int ret = bind(listenFd, (struct sockaddr*)&addr, sizeof(addr));
+    assert(ret == 0);
+    listen(listenFd, 8);
+    getsockname(listenFd, (struct sockaddr*)&addr, &len);
+    bool ok = poller.AddListenFd(listenFd, EPOLLIN | EPOLLRDHUP);
+    assert(ok);
+
+    // 两个连接，multishot accept注册一次都能收到
+    int clients[2];
+    int accepted[2];
+    for(int i = 0; i < 2; i++) {
+        clients[i] = socket(AF_INET, SOCK_STREAM, 0);
+        ret = connect(clients[i], (struct sockaddr*)&addr, sizeof(addr));
+        assert(ret == 0);
+        int n = poller.Wait(1000);
+        assert(n == 1 && poller.GetEventPtr(0) == nullptr);
+        accepted[i] = poller.GetAcceptedFd(0);
+        if(accepted[i] < 0) {   // 不支持buffer ring时退回poll，自己accept
+            assert(!poller.HasBufRing());
+            accepted[i] = accept(listenFd, nullptr, nullptr);
+        }
+        assert(accepted[i] >= 0);
+    }
+
+    HttpConn::isET = true;
+    HttpConn conn;
+    conn.init(accepted[0], addr);
+    ok = poller.AddFd(accepted[0], EPOLLIN | EPOLLONESHOT | EPOLLRDHUP, &conn);
+    assert(ok);
+    ssize_t sent = write(clients[0], "hello", 5);
+    assert(sent == 5);
+    int n = poller.Wait(1000);
+    assert(n == 1 && poller.GetEventPtr(0) == &conn && poller.GetEvents(0) == EPOLLIN);
+    const char* data = nullptr;
+    size_t got = poller.GetData(0, &data);
+    assert(got == (poller.HasBufRing() ? 5u : 0u));
+    if(got) {
+        // 收到的数据喂给连接，read直接返回它
+        conn.Feed(data, got);
+        assert(memcmp(data, "hello", 5) == 0);
+    }
+    int err = 0;
+    ssize_t readLen = conn.read(&err);
+    assert(readLen == 5);
+
+    // 对端关闭
+    ok = poller.ModFd(accepted[0], EPOLLIN | EPOLLONESHOT | EPOLLRDHUP, &conn);
+    assert(ok);
+    close(clients[0]);
+    n = poller.Wait(1000);
+    assert(n == 1 && (poller.GetEvents(0) & EPOLLRDHUP));
+    poller.DelFd(accepted[0]);
+    conn.Close();
+    HttpConn::isET = false;
+
+    close(accepted[1]);
+    close(clients[1]);
+    poller.DelFd(listenFd);
+    close(listenFd);
+}
+
 int main() {
     TestLog();
+    TestBuffer();
+    TestParser();
+    TestFileCache();
+    TestSendBody();
+    TestPrecompress();
+    TestCompressCache();
+    TestConditional();
+    TestRange();
+    TestStream();
+    TestPipeline();
+    TestReadBudget();
+    TestBlockingRequest();
+    TestUringPoller();
+    TestFileWatcher();
+    TestTimer();
+    TestTaskAlloc();
+    TestWorkStealing();
     TestThreadPool();
 }
\ No newline at end of file